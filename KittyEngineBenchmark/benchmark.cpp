@@ -0,0 +1,350 @@
+#include "../KittyEngineV5/board.cpp"
+#include "../KittyEngineV5/benchmark.h"
+#include "../KittyEngineV5/move_list.h"
+#include "../KittyEngineV5/packed_position.h"
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <benchmark/benchmark.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// Each iteration runs a whole fixed batch of inputs, so the per item times do not depend on the order they come in.
+// Every benchmark runs a fixed number of iterations and repetitions, and reports the mean, median, spread and
+// minimum of the repetitions. The minimum is the least disturbed by other processes, compare it between two
+// JSON runs with Google Benchmark's tools/compare.py.
+namespace {
+  constexpr int kRepetitions = 10;
+
+  const std::array<const char*, 6> kFens = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - ",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+  };
+
+  // The positions with the masks the move generator would compute for the side to move.
+  struct Position {
+    BoardState state;
+    Square kingSq;
+    std::array<Bitboard, kColorSize> occupancy;
+    Bitboard bothOccupancy;
+  };
+
+  const std::vector<Position>& getPositions() {
+    static const std::vector<Position> positions = []() {
+      std::vector<Position> result;
+      for (const char* fen : kFens) {
+        // Both sides to move, so each color's templates are measured.
+        for (Color color : { kWhite, kBlack }) {
+          Position position{ BoardState::fromFEN(fen) };
+          position.state.color_ = color;
+          if (color == kWhite ? position.state.isInCheck<kBlack>() : position.state.isInCheck<kWhite>()) {
+            continue;
+          }
+          position.kingSq = peekPiece(position.state.bitboards_[color][kKing]);
+          position.occupancy = { position.state.getOccupancy(kWhite), position.state.getOccupancy(kBlack) };
+          position.bothOccupancy = position.occupancy[kWhite] | position.occupancy[kBlack];
+          result.push_back(position);
+        }
+      }
+      return result;
+    }();
+    return positions;
+  }
+
+  const std::vector<bench::internal::SliderQuery>& getSliderQueries() {
+    static const std::vector<bench::internal::SliderQuery> queries = bench::internal::generateSliderQueries(1 << 10);
+    return queries;
+  }
+
+  template <Piece piece>
+  void BM_GetLeaperAttack(benchmark::State& state) {
+    for (auto _ : state) {
+      for (Square square = 0; square < kSquareSize; ++square) {
+        if constexpr (piece == kPawn) {
+          benchmark::DoNotOptimize(getAttack<kPawn, kWhite>(square));
+          benchmark::DoNotOptimize(getAttack<kPawn, kBlack>(square));
+        } else {
+          benchmark::DoNotOptimize(getAttack<piece>(square));
+        }
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * kSquareSize * (piece == kPawn ? 2 : 1));
+  }
+
+  template <Piece piece>
+  void BM_GetSliderAttack(benchmark::State& state) {
+    const std::vector<bench::internal::SliderQuery>& queries = getSliderQueries();
+    for (auto _ : state) {
+      for (const bench::internal::SliderQuery& query : queries) {
+        benchmark::DoNotOptimize(getAttack<piece>(query.square, query.occupancy));
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(queries.size()));
+  }
+
+  // Run a mask computation for the side to move of every position.
+  template <typename Compute>
+  void runMaskBenchmark(benchmark::State& state, Compute compute) {
+    const std::vector<Position>& positions = getPositions();
+    for (auto _ : state) {
+      for (const Position& position : positions) {
+        benchmark::DoNotOptimize(position.state.getColor() == kWhite ? compute.template operator()<kWhite>(position)
+                                                                     : compute.template operator()<kBlack>(position));
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(positions.size()));
+  }
+
+  void BM_GetCheckedMask(benchmark::State& state) {
+    runMaskBenchmark(state, []<Color our>(const Position& position) {
+      return position.state.getCheckedMask<our>(position.kingSq, position.bothOccupancy);
+    });
+  }
+
+  void BM_GetPinnedMask(benchmark::State& state) {
+    runMaskBenchmark(state, []<Color our>(const Position& position) {
+      return position.state.getPinnedMask<our>(position.kingSq, position.occupancy);
+    });
+  }
+
+  void BM_GetAttackedMask(benchmark::State& state) {
+    runMaskBenchmark(state, []<Color our>(const Position& position) {
+      return position.state.getAttackedMask<our>(position.bothOccupancy);
+    });
+  }
+
+  void BM_EnumerateMoves(benchmark::State& state) {
+    const std::vector<Position>& positions = getPositions();
+    for (auto _ : state) {
+      for (const Position& position : positions) {
+        MoveList moves = MoveList::fromState(position.state);
+        benchmark::DoNotOptimize(moves);
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(positions.size()));
+  }
+
+  // Copy-make of every legal move of every position.
+  void BM_MakeMove(benchmark::State& state) {
+    std::vector<std::pair<BoardState, PackedMove>> moves;
+    for (const Position& position : getPositions()) {
+      for (PackedMove move : MoveList::fromState(position.state)) {
+        moves.emplace_back(position.state, move);
+      }
+    }
+    for (auto _ : state) {
+      for (const auto& [parent, move] : moves) {
+        BoardState child = parent;
+        child.makeMove(move);
+        benchmark::DoNotOptimize(child);
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(moves.size()));
+  }
+
+  void BM_FromFEN(benchmark::State& state) {
+    const std::vector<std::string> fens(kFens.begin(), kFens.end());
+    for (auto _ : state) {
+      for (const std::string& fen : fens) {
+        benchmark::DoNotOptimize(BoardState::fromFEN(fen));
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(fens.size()));
+  }
+
+  // Items are positions, so items_per_second reads as positions per second.
+  void BM_ParseFEN(benchmark::State& state) {
+    BoardState boardState{};
+    for (auto _ : state) {
+      for (const char* fen : kFens) {
+        benchmark::DoNotOptimize(BoardState::parseFEN(fen, boardState));
+        benchmark::DoNotOptimize(boardState);
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(kFens.size()));
+  }
+
+  void BM_ToFEN(benchmark::State& state) {
+    std::vector<BoardState> states;
+    for (const char* fen : kFens) {
+      states.push_back(BoardState::fromFEN(fen));
+    }
+    std::array<char, BoardState::kMaxFenLength> buffer;
+    for (auto _ : state) {
+      for (const BoardState& boardState : states) {
+        benchmark::DoNotOptimize(boardState.toFEN(buffer));
+        benchmark::ClobberMemory();
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(states.size()));
+  }
+
+  void BM_PackPosition(benchmark::State& state) {
+    const std::vector<Position>& positions = getPositions();
+    packed::PackedPosition packedPosition;
+    for (auto _ : state) {
+      for (const Position& position : positions) {
+        benchmark::DoNotOptimize(packed::pack(position.state, packedPosition));
+        benchmark::DoNotOptimize(packedPosition);
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(positions.size()));
+  }
+
+  void BM_UnpackPosition(benchmark::State& state) {
+    std::vector<packed::PackedPosition> packedPositions;
+    for (const Position& position : getPositions()) {
+      packed::pack(position.state, packedPositions.emplace_back());
+    }
+    BoardState boardState{};
+    for (auto _ : state) {
+      for (const packed::PackedPosition& packedPosition : packedPositions) {
+        benchmark::DoNotOptimize(packed::unpack(packedPosition, boardState));
+        benchmark::DoNotOptimize(boardState);
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(packedPositions.size()));
+  }
+
+  // Every position up to 3 plies from the start and all its moves, written to a temporary book and mapped.
+  struct BookFixture {
+    std::string path;
+    std::vector<BoardState> states;
+    std::unique_ptr<polyglot::Book> book;
+
+    BookFixture() : path((std::filesystem::temp_directory_path() / "kitty_benchmark_book.bin").string()), states(), book() {
+      std::vector<polyglot::BookEntry> entries;
+      bench::internal::collectBookEntries(BoardState::fromFEN(kFens[0]), 4, states, entries);
+      polyglot::writeBook(path, entries);
+      book = polyglot::Book::open(path);
+      std::shuffle(states.begin(), states.end(), std::mt19937_64(0x4b69747479));
+    }
+
+    ~BookFixture() {
+      book.reset();
+      std::filesystem::remove(path);
+    }
+  };
+
+  const BookFixture& getBookFixture() {
+    static const BookFixture fixture;
+    return fixture;
+  }
+
+  // The book stays in the page cache, every probe is a hit and maps a legal move. The cold probe is "bench book".
+  void BM_BookProbe(benchmark::State& state) {
+    const BookFixture& fixture = getBookFixture();
+    std::mt19937_64 rng(0x4b69747479);
+    for (auto _ : state) {
+      for (const BoardState& boardState : fixture.states) {
+        benchmark::DoNotOptimize(fixture.book->probe(boardState, rng()));
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(fixture.states.size()));
+  }
+
+  // Random legal king and pawn positions, the side with the pawn chosen at random as well.
+  const std::vector<BoardState>& getKpkStates() {
+    static const std::vector<BoardState> states = []() {
+      std::mt19937_64 rng(0x4b69747479);
+      std::vector<BoardState> result;
+      while (result.size() < (1 << 16)) {
+        BoardState state{};
+        state.mailbox_.fill(BoardState::kEmptyCell);
+        state.enpassant_ = NO_SQUARE;
+        state.color_ = static_cast<Color>(rng() & 1);
+        const Color strong = static_cast<Color>(rng() & 1);
+        const Square squares[3] = { static_cast<Square>(rng() % kSquareSize), static_cast<Square>(8 + rng() % 48), static_cast<Square>(rng() % kSquareSize) };
+        if (squares[0] == squares[1] || squares[1] == squares[2] || isSquareSet(getAttack<kKing>(squares[0]) | toBitboard(squares[0]), squares[2])) {
+          continue;
+        }
+        state.bitboards_[strong][kKing] = toBitboard(squares[0]);
+        state.bitboards_[strong][kPawn] = toBitboard(squares[1]);
+        state.bitboards_[strong ^ 1][kKing] = toBitboard(squares[2]);
+        state.mailbox_ = state.computeMailbox();
+        if (!(state.getColor() == kWhite ? state.isInCheck<kBlack>() : state.isInCheck<kWhite>())) {
+          result.push_back(state);
+        }
+      }
+      return result;
+    }();
+    return states;
+  }
+
+  void BM_BitbaseProbe(benchmark::State& state) {
+    const bitbase::Tables& tables = bitbase::getTables();
+    const std::vector<BoardState>& states = getKpkStates();
+    for (auto _ : state) {
+      for (const BoardState& boardState : states) {
+        benchmark::DoNotOptimize(tables.probe(boardState));
+      }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(states.size()));
+  }
+}
+
+// Iteration counts keep each repetition around 20 to 50 ms.
+#define KITTY_BENCHMARK(function, iterations)                                                            \
+  BENCHMARK(function)->Iterations(iterations)->Repetitions(kRepetitions)->ReportAggregatesOnly(true)     \
+    ->ComputeStatistics("min", [](const std::vector<double>& values) { return *std::min_element(values.begin(), values.end()); })
+
+KITTY_BENCHMARK(BM_GetLeaperAttack<kPawn>, 800000);
+KITTY_BENCHMARK(BM_GetLeaperAttack<kKnight>, 800000);
+KITTY_BENCHMARK(BM_GetLeaperAttack<kKing>, 800000);
+KITTY_BENCHMARK(BM_GetSliderAttack<kBishop>, 20000);
+KITTY_BENCHMARK(BM_GetSliderAttack<kRook>, 20000);
+KITTY_BENCHMARK(BM_GetSliderAttack<kQueen>, 10000);
+KITTY_BENCHMARK(BM_GetCheckedMask, 1000000);
+KITTY_BENCHMARK(BM_GetPinnedMask, 1000000);
+KITTY_BENCHMARK(BM_GetAttackedMask, 400000);
+KITTY_BENCHMARK(BM_EnumerateMoves, 50000);
+KITTY_BENCHMARK(BM_MakeMove, 5000);
+KITTY_BENCHMARK(BM_FromFEN, 5000);
+KITTY_BENCHMARK(BM_ParseFEN, 5000);
+KITTY_BENCHMARK(BM_ToFEN, 50000);
+KITTY_BENCHMARK(BM_PackPosition, 100000);
+KITTY_BENCHMARK(BM_UnpackPosition, 50000);
+KITTY_BENCHMARK(BM_BookProbe, 5);
+KITTY_BENCHMARK(BM_BitbaseProbe, 20);
+
+// Pin the process to the core it starts on, so the scheduler does not migrate it between repetitions.
+// Results go to kitty_benchmark.json as well, unless another output file is given.
+int main(int argc, char** argv) {
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(sched_getcpu(), &cpus);
+  sched_setaffinity(0, sizeof(cpus), &cpus);
+#endif
+
+  std::vector<char*> args(argv, argv + argc);
+  std::string outFlag = "--benchmark_out=kitty_benchmark.json";
+  std::string formatFlag = "--benchmark_out_format=json";
+  bool hasOut = false;
+  for (char* arg : args) {
+    hasOut = hasOut || std::string_view(arg).starts_with("--benchmark_out=");
+  }
+  if (!hasOut) {
+    args.push_back(outFlag.data());
+    args.push_back(formatFlag.data());
+  }
+  int argCount = static_cast<int>(args.size());
+
+  benchmark::Initialize(&argCount, args.data());
+  if (benchmark::ReportUnrecognizedArguments(argCount, args.data())) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
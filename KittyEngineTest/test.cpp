@@ -1,6 +1,26 @@
 #include "../KittyEngineV5/board.cpp"
+#include "../KittyEngineV5/bitbase.h"
+#include "../KittyEngineV5/move_list.h"
+#include "../KittyEngineV5/move_picker.h"
+#include "../KittyEngineV5/nnue.h"
+#include "../KittyEngineV5/packed_position.h"
 #include "../KittyEngineV5/perft_driver.h"
+#include "../KittyEngineV5/perft_suite.h"
+#include "../KittyEngineV5/polyglot.h"
+#include "../KittyEngineV5/search.h"
+#include "../KittyEngineV5/uci.h"
+#include <algorithm>
 #include <array>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
 #include <gtest/gtest.h>
 
 // https://www.chessprogramming.org/Perft_Results
@@ -185,3 +205,1140 @@ TEST(TestPerft, TestHorizontalCanNotEnpassant) {
     EXPECT_EQ(result.nodes, results[depth].nodes);
   }
 }
+
+TEST(TestPerft, TestParallelMatchesSerial) {
+  BoardState state = BoardState::fromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ");
+
+  for (uint32_t threadCount : {2u, 3u, 8u}) {
+    for (uint32_t depth = 1; depth <= 4; ++depth) {
+      perft::Result serial = perft::runPerft<perft::Config{ false, true, false }, false>(state, depth);
+      perft::Result parallel = perft::runPerft<perft::Config{ true, true, false }, false>(state, depth, threadCount);
+      EXPECT_EQ(serial.nodes, parallel.nodes);
+    }
+  }
+}
+
+TEST(TestPerft, TestBulkCountMatchesMoveByMove) {
+  for (const char* fen : {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                          "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+                          "7k/4p2q/2q5/3P1P2/4K3/8/8/8 b - - 0 1"}) {
+    BoardState state = BoardState::fromFEN(fen);
+    for (uint32_t depth = 1; depth <= 4; ++depth) {
+      perft::Result moveByMove = perft::runPerft<perft::Config{ false, false, false }, false>(state, depth);
+      perft::Result bulk = perft::runPerft<perft::Config{ false, true, false }, false>(state, depth);
+      EXPECT_EQ(moveByMove.nodes, bulk.nodes);
+    }
+  }
+}
+
+template <size_t depth>
+struct ZobristKeyChecker {
+  template <MoveType moveType>
+  void acceptMove(BoardState state, Move<moveType> move) {
+    state.makeMove(move);
+    EXPECT_EQ(state.key_, state.computeKey());
+    if constexpr (depth > 1) {
+      ZobristKeyChecker<depth - 1> checker;
+      state.enumerateMoves<getOtherColor(moveType.color)>(checker);
+    }
+  }
+};
+
+TEST(TestZobrist, TestIncrementalKeyMatchesFullKey) {
+  for (const char* fen : {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+                          "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                          "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - "}) {
+    BoardState state = BoardState::fromFEN(fen);
+    ZobristKeyChecker<3> checker;
+    state.getColor() == kWhite ? state.enumerateMoves<kWhite>(checker) : state.enumerateMoves<kBlack>(checker);
+  }
+}
+
+TEST(TestPerft, TestHashedMatchesUnhashed) {
+  // A tiny table forces constant replacement.
+  perft::HashTable hashTable(1);
+  for (const char* fen : {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+                          "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - "}) {
+    BoardState state = BoardState::fromFEN(fen);
+    for (uint32_t depth = 1; depth <= 5; ++depth) {
+      hashTable.clear();
+      perft::Result unhashed = perft::runPerft<perft::Config{ false, true, false }, false>(state, depth);
+      perft::Result hashed = perft::runPerft<perft::Config{ false, true, false, true }, false>(state, depth, 1, &hashTable);
+      perft::Result parallelHashed = perft::runPerft<perft::Config{ true, true, false, true }, false>(state, depth, 4, &hashTable);
+      EXPECT_EQ(unhashed.nodes, hashed.nodes);
+      EXPECT_EQ(unhashed.nodes, parallelHashed.nodes);
+    }
+  }
+}
+
+// https://www.chessprogramming.org/Perft_Results
+TEST(TestDetailedPerft, TestDetailedPositions) {
+  const std::vector<std::pair<const char*, std::vector<perft::Result>>> positions = {
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", {
+      perft::Result{20, 0, 0, 0, 0, 0, 0, 0, 0},
+      perft::Result{400, 0, 0, 0, 0, 0, 0, 0, 0},
+      perft::Result{8902, 34, 0, 0, 0, 12, 0, 0, 0},
+      perft::Result{197281, 1576, 0, 0, 0, 469, 0, 0, 8},
+      perft::Result{4865609, 82719, 258, 0, 0, 27351, 6, 0, 347},
+    }},
+    {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ", {
+      perft::Result{48, 8, 0, 2, 0, 0, 0, 0, 0},
+      perft::Result{2039, 351, 1, 91, 0, 3, 0, 0, 0},
+      perft::Result{97862, 17102, 45, 3162, 0, 993, 0, 0, 1},
+      perft::Result{4085603, 757163, 1929, 128013, 15172, 25523, 42, 6, 43},
+    }},
+    {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - ", {
+      perft::Result{14, 1, 0, 0, 0, 2, 0, 0, 0},
+      perft::Result{191, 14, 0, 0, 0, 10, 0, 0, 0},
+      perft::Result{2812, 209, 2, 0, 0, 267, 3, 0, 0},
+      perft::Result{43238, 3348, 123, 0, 0, 1680, 106, 0, 17},
+      perft::Result{674624, 52051, 1165, 0, 0, 52950, 1292, 3, 0},
+    }},
+    {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", {
+      perft::Result{6, 0, 0, 0, 0, 0, 0, 0, 0},
+      perft::Result{264, 87, 0, 6, 48, 10, 0, 0, 0},
+      perft::Result{9467, 1021, 4, 0, 120, 38, 2, 0, 22},
+      perft::Result{422333, 131393, 0, 7795, 60032, 15492, 19, 0, 5},
+    }},
+    // Castling checks with the rook, which is a direct check.
+    {"5k2/8/8/8/8/8/8/4K2R w K - 0 1", {
+      perft::Result{15, 0, 0, 1, 0, 3, 0, 0, 0},
+    }},
+    {"r3k3/8/8/8/8/8/8/3K4 b q - 0 1", {
+      perft::Result{16, 0, 0, 1, 0, 3, 0, 0, 0},
+    }},
+  };
+
+  for (const auto& [fen, results] : positions) {
+    BoardState state = BoardState::fromFEN(fen);
+    for (uint32_t depth = 1; depth <= results.size(); ++depth) {
+      perft::Result result = perft::runPerft<perft::Config{ true, false, true }, false>(state, depth);
+      const perft::Result& expected = results[depth - 1];
+      EXPECT_EQ(result.nodes, expected.nodes) << fen << " depth " << depth;
+      EXPECT_EQ(result.captures, expected.captures) << fen << " depth " << depth;
+      EXPECT_EQ(result.enpassants, expected.enpassants) << fen << " depth " << depth;
+      EXPECT_EQ(result.castles, expected.castles) << fen << " depth " << depth;
+      EXPECT_EQ(result.promotions, expected.promotions) << fen << " depth " << depth;
+      EXPECT_EQ(result.checks, expected.checks) << fen << " depth " << depth;
+      EXPECT_EQ(result.discoveryChecks, expected.discoveryChecks) << fen << " depth " << depth;
+      EXPECT_EQ(result.doubleChecks, expected.doubleChecks) << fen << " depth " << depth;
+      EXPECT_EQ(result.checkmates, expected.checkmates) << fen << " depth " << depth;
+    }
+  }
+}
+
+#ifdef KITTY_ENABLE_PEXT
+TEST(TestSliderAttack, TestPextMatchesMagic) {
+  for (Square square = 0; square < kSquareSize; ++square) {
+    for (size_t i = 0; i < 2; ++i) {
+      const internal::SliderAttackTable& table = internal::sliderAttackTables[square][i];
+      for (Bitboard occupancy = table.maxAttackNoEdge; ; occupancy = (occupancy - 1) & table.maxAttackNoEdge) {
+        const Bitboard magicAttack = (i == 0 ? table.getAttack<kBishop>(occupancy) : table.getAttack<kRook>(occupancy));
+        EXPECT_EQ(table.getPextAttack(occupancy), magicAttack);
+        if (occupancy == 0) {
+          break;
+        }
+      }
+    }
+  }
+}
+#endif
+
+uint64_t perftWithMoveList(const BoardState& state, uint32_t depth) {
+  const MoveList moves = MoveList::fromState(state);
+  if (depth <= 1) {
+    return moves.size();
+  }
+
+  uint64_t nodes = 0;
+  for (PackedMove move : moves) {
+    BoardState child = state;
+    child.makeMove(move);
+    EXPECT_EQ(child.key_, child.computeKey());
+    nodes += perftWithMoveList(child, depth - 1);
+  }
+  return nodes;
+}
+
+TEST(TestMoveList, TestPackedMovePerft) {
+  EXPECT_EQ(perftWithMoveList(BoardState::fromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - "), 3), 97862);
+  EXPECT_EQ(perftWithMoveList(BoardState::fromFEN("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - "), 4), 43238);
+  EXPECT_EQ(perftWithMoveList(BoardState::fromFEN("r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"), 3), 9467);
+}
+
+TEST(TestMoveList, TestPackedMoveEncoding) {
+  const PackedMove promotion = PackedMove::fromMove(Move<MoveType{kWhite, kPawn, kRook, false, false, false, false}>(B7, A8));
+  EXPECT_EQ(promotion.getSrce(), B7);
+  EXPECT_EQ(promotion.getDest(), A8);
+  EXPECT_EQ(promotion.getPromotionPiece(), kRook);
+  EXPECT_EQ(moveToString(promotion), "b7a8r");
+
+  const PackedMove castle = PackedMove::fromMove(Move<MoveType{kBlack, kKing, 0, false, false, false, true}>(E8, C8));
+  EXPECT_EQ(castle.getFlag(), PackedMove::kQueenSideCastle);
+  EXPECT_FALSE(castle.isPromotion());
+  EXPECT_EQ(moveToString(castle), "e8c8");
+}
+
+template <GenerationType genType>
+std::vector<PackedMove> generateSorted(const BoardState& state) {
+  const MoveList moves = MoveList::fromState<genType>(state);
+  std::vector<PackedMove> sorted(moves.begin(), moves.end());
+  std::sort(sorted.begin(), sorted.end());
+  return sorted;
+}
+
+template <GenerationType genType>
+uint32_t countBulk(const BoardState& state) {
+  perft::internal::MoveCounter counter{};
+  state.getColor() == kWhite ? state.enumerateMoves<kWhite, genType>(counter) : state.enumerateMoves<kBlack, genType>(counter);
+  return counter.count;
+}
+
+// Captures and quiets must split the legal moves exactly, and evasions must match them while in check.
+void checkGenerationModes(const BoardState& state, uint32_t depth) {
+  const std::vector<PackedMove> all = generateSorted<kAllMoves>(state);
+  const std::vector<PackedMove> captures = generateSorted<kCaptureMoves>(state);
+  const std::vector<PackedMove> quiets = generateSorted<kQuietMoves>(state);
+  std::vector<PackedMove> merged;
+  std::merge(captures.begin(), captures.end(), quiets.begin(), quiets.end(), std::back_inserter(merged));
+  ASSERT_EQ(merged, all);
+  EXPECT_EQ(countBulk<kCaptureMoves>(state), captures.size());
+  EXPECT_EQ(countBulk<kQuietMoves>(state), quiets.size());
+
+  const bool isInCheck = (state.getColor() == kWhite ? state.isInCheck<kWhite>() : state.isInCheck<kBlack>());
+  if (isInCheck) {
+    EXPECT_EQ(generateSorted<kEvasionMoves>(state), all);
+    EXPECT_EQ(countBulk<kEvasionMoves>(state), all.size());
+  }
+
+  if (depth > 1) {
+    for (PackedMove move : all) {
+      BoardState child = state;
+      child.makeMove(move);
+      checkGenerationModes(child, depth - 1);
+    }
+  }
+}
+
+TEST(TestMoveGeneration, TestGenerationModesPartition) {
+  checkGenerationModes(BoardState::fromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - "), 3);
+  checkGenerationModes(BoardState::fromFEN("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - "), 4);
+  checkGenerationModes(BoardState::fromFEN("r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1"), 3);
+  checkGenerationModes(BoardState::fromFEN("rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8"), 3);
+}
+
+TEST(TestSearch, TestFindsMateInOne) {
+  const search::Result result = search::search(BoardState::fromFEN("6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1"), { .depth = 4 });
+  EXPECT_EQ(moveToString(result.bestMove), "a1a8");
+  EXPECT_EQ(result.score, search::kMateScore - 1);
+}
+
+TEST(TestSearch, TestWinsHangingQueen) {
+  const search::Result result = search::search(BoardState::fromFEN("4k3/8/8/3q4/8/8/3R4/4K3 w - - 0 1"), { .depth = 3 });
+  EXPECT_EQ(moveToString(result.bestMove), "d2d5");
+  EXPECT_EQ(result.depth, 3);
+}
+
+TEST(TestSearch, TestQuiescenceSeesRecapture) {
+  // The pawn on d5 is defended, taking it with the queen only looks good to a search that stops before the recapture.
+  const BoardState state = BoardState::fromFEN("4k3/8/4p3/3p4/8/8/8/3QK3 w - - 0 1");
+  search::TranspositionTable tt(1);
+  auto searcher = std::make_unique<search::Searcher>(tt);
+  searcher->setQuiescence(false);
+  const search::Result horizon = searcher->search(state, { .depth = 1 });
+  EXPECT_EQ(moveToString(horizon.bestMove), "d1d5");
+  EXPECT_EQ(horizon.quiescenceNodes, 0);
+
+  tt.clear();
+  searcher->setQuiescence(true);
+  const search::Result quiet = searcher->search(state, { .depth = 1 });
+  EXPECT_NE(moveToString(quiet.bestMove), "d1d5");
+  EXPECT_GT(quiet.quiescenceNodes, 0);
+  EXPECT_LT(quiet.quiescenceNodes, quiet.nodes);
+}
+
+TEST(TestSearch, TestQuiescenceMatesInCheck) {
+  // Rxa8 is mate, so the quiescence search after it must find no evasion instead of standing pat.
+  const search::Result result = search::search(BoardState::fromFEN("r5k1/5ppp/8/8/8/8/5PPP/R5K1 w - - 0 1"), { .depth = 1 });
+  EXPECT_EQ(moveToString(result.bestMove), "a1a8");
+  EXPECT_EQ(result.score, search::kMateScore - 1);
+}
+
+TEST(TestSearch, TestNoLegalMoves) {
+  const search::Result stalemate = search::search(BoardState::fromFEN("7k/5Q2/6K1/8/8/8/8/8 b - - 0 1"), { .depth = 5 });
+  EXPECT_TRUE(stalemate.bestMove.isNull());
+  EXPECT_EQ(stalemate.score, 0);
+
+  const search::Result checkmate = search::search(BoardState::fromFEN("R5k1/5ppp/8/8/8/8/8/6K1 b - - 0 1"), { .depth = 5 });
+  EXPECT_TRUE(checkmate.bestMove.isNull());
+  EXPECT_EQ(checkmate.score, -search::kMateScore);
+}
+
+TEST(TestSearch, TestReachesDepthWithLegalPv) {
+  const BoardState state = BoardState::fromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ");
+  const search::Result result = search::search(state, { .depth = 4 });
+  EXPECT_EQ(result.depth, 4);
+  EXPECT_EQ(result.pv.size(), 4);
+
+  // Every move along the principal variation must be legal in its position.
+  BoardState child = state;
+  for (PackedMove move : result.pv) {
+    const MoveList moves = MoveList::fromState(child);
+    ASSERT_NE(std::find(moves.begin(), moves.end(), move), moves.end());
+    child.makeMove(move);
+  }
+}
+
+TEST(TestSearch, TestNodeLimitStops) {
+  const search::Result result = search::search(BoardState::fromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"), { .nodes = 100000 });
+  EXPECT_FALSE(result.bestMove.isNull());
+  EXPECT_LT(result.nodes, 110000);
+}
+
+TEST(TestTranspositionTable, TestStoreAndReplace) {
+  search::TranspositionTable tt(1, 2);
+  const PackedMove move = PackedMove::fromMove(Move<MoveType{kWhite, kPawn, kQueen, false, false, false, false}>(B7, B8));
+  search::TTData data{};
+  EXPECT_FALSE(tt.probe(0x1234, data));
+
+  tt.store(0x1234, move, -search::kMateScore + 5, 7, search::kLowerBound);
+  ASSERT_TRUE(tt.probe(0x1234, data));
+  EXPECT_EQ(data.move, move);
+  EXPECT_EQ(data.score, -search::kMateScore + 5);
+  EXPECT_EQ(data.depth, 7);
+  EXPECT_EQ(data.bound, search::kLowerBound);
+
+  // Keys sharing a bucket, the shallow entries are evicted before the deep one.
+  constexpr uint64_t kStride = uint64_t{ 1 } << 40;
+  for (uint64_t i = 1; i <= 8; ++i) {
+    tt.store(0x1234 + i * kStride, kNullMove, 0, 1, search::kExactBound);
+  }
+  EXPECT_TRUE(tt.probe(0x1234, data));
+  EXPECT_FALSE(tt.probe(0x1234 + kStride, data));
+  EXPECT_TRUE(tt.probe(0x1234 + 8 * kStride, data));
+
+  tt.clear(2);
+  EXPECT_FALSE(tt.probe(0x1234, data));
+  EXPECT_EQ(tt.getHashFull(), 0);
+}
+
+TEST(TestTranspositionTable, TestConcurrentWritesNeverMismatch) {
+  search::TranspositionTable tt(1);
+  std::atomic<bool> isDone = false;
+  std::vector<std::thread> writers;
+  for (uint64_t t = 0; t < 3; ++t) {
+    writers.emplace_back([&tt, t]() {
+      for (uint32_t i = 0; i < 200000; ++i) {
+        // The depth encodes the key, so a validated hit with the wrong depth would be a torn entry.
+        const uint64_t key = ((i + t) % 16) << 32;
+        tt.store(key, kNullMove, 0, static_cast<uint32_t>((key >> 32) + 1), search::kExactBound);
+      }
+    });
+  }
+  std::thread reader([&tt, &isDone]() {
+    search::TTData data{};
+    while (!isDone.load()) {
+      for (uint64_t k = 0; k < 16; ++k) {
+        if (tt.probe(k << 32, data)) {
+          EXPECT_EQ(data.depth, k + 1);
+        }
+      }
+    }
+  });
+  for (std::thread& writer : writers) {
+    writer.join();
+  }
+  isDone = true;
+  reader.join();
+}
+
+TEST(TestSearch, TestTableKeepsSearchResult) {
+  const BoardState state = BoardState::fromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ");
+  search::TranspositionTable tt(4);
+  auto searcher = std::make_unique<search::Searcher>(tt);
+  const search::Result first = searcher->search(state, { .depth = 5 });
+  const search::Result second = searcher->search(state, { .depth = 5 });
+  EXPECT_EQ(first.score, second.score);
+  EXPECT_LT(second.nodes, first.nodes);
+}
+
+TEST(TestUci, TestParseMoveMatchesGenerator) {
+  // Every legal move must round trip through its UCI string, special moves included.
+  for (const char* fen : { "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+                           "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 b kq - 0 1",
+                           "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3" }) {
+    const BoardState state = BoardState::fromFEN(fen);
+    for (PackedMove move : MoveList::fromState(state)) {
+      EXPECT_EQ(state.parseMove(moveToString(move)), move) << fen << ' ' << moveToString(move);
+    }
+  }
+  const BoardState state = BoardState::fromFEN(uci::kStartFEN);
+  EXPECT_TRUE(state.parseMove("e2e").isNull());
+  EXPECT_TRUE(state.parseMove("e3e4").isNull());
+}
+
+TEST(TestUci, TestPositionAndGo) {
+  std::ostringstream out;
+  {
+    uci::Engine engine(out);
+    EXPECT_TRUE(engine.execute("position startpos moves e2e4 e7e5 g1f3 b8c6 f1c4 g8f6 e1g1"));
+    EXPECT_TRUE(engine.execute("go depth 3"));
+    engine.wait();
+    EXPECT_TRUE(engine.execute("position fen 8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - moves e2e4"));
+    EXPECT_TRUE(engine.execute("go perft 3"));
+    engine.wait();
+    EXPECT_FALSE(engine.execute("quit"));
+  }
+  EXPECT_NE(out.str().find("info depth 3"), std::string::npos);
+  EXPECT_NE(out.str().find("bestmove "), std::string::npos);
+  EXPECT_NE(out.str().find("Nodes searched: "), std::string::npos);
+}
+
+std::string toFenString(const BoardState& state) {
+  std::array<char, BoardState::kMaxFenLength> buffer;
+  return std::string(buffer.data(), state.toFEN(buffer));
+}
+
+TEST(TestFen, TestRoundTrip) {
+  for (const char* fen : { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+                           "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+                           "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                           "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",
+                           "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 99 4294967295" }) {
+    BoardState state{};
+    ASSERT_EQ(BoardState::parseFEN(fen, state), kFenOk) << fen;
+    EXPECT_EQ(toFenString(state), fen);
+
+    // The children cover castle rights lost, enpassant squares and promotions.
+    for (PackedMove move : MoveList::fromState(state)) {
+      BoardState child = state;
+      child.makeMove(move);
+      const std::string childFen = toFenString(child);
+      BoardState parsed{};
+      ASSERT_EQ(BoardState::parseFEN(childFen, parsed), kFenOk) << childFen;
+      EXPECT_EQ(toFenString(parsed), childFen);
+      EXPECT_EQ(parsed.mailbox_, child.mailbox_);
+      EXPECT_EQ(parsed.psqt_, child.psqt_);
+      EXPECT_EQ(MoveList::fromState(parsed).size(), MoveList::fromState(child).size()) << childFen;
+    }
+  }
+
+  std::array<char, BoardState::kMaxFenLength - 1> shortBuffer;
+  EXPECT_EQ(BoardState::fromFEN(uci::kStartFEN).toFEN(shortBuffer), 0);
+}
+
+TEST(TestFen, TestRejectsMalformed) {
+  const std::vector<std::pair<const char*, FenError>> cases = {
+    { "", kFenBadBoard },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP w KQkq -", kFenBadBoard },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR/8 w KQkq -", kFenBadBoard },
+    { "rnbqkbnr/pppppppp/9/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -", kFenBadBoard },
+    { "rnbqkbnr/ppppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -", kFenBadBoard },
+    { "rnbqkbnr/ppppxppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -", kFenBadBoard },
+    { "Pnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -", kFenBadBoard },
+    { "rnbq1bnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -", kFenBadKings },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBKKBNR w KQkq -", kFenBadKings },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR", kFenBadColor },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR x KQkq -", kFenBadColor },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w", kFenBadCastle },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkx -", kFenBadCastle },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq", kFenBadEnpassant },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq e3", kFenBadEnpassant },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq i6", kFenBadEnpassant },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - x 1", kFenBadCounter },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1x", kFenBadCounter },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 4294967296", kFenBadCounter },
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 moves", kFenBadCounter },
+  };
+  const BoardState startState = BoardState::fromFEN(uci::kStartFEN);
+  for (const auto& [fen, error] : cases) {
+    BoardState state = startState;
+    EXPECT_EQ(BoardState::parseFEN(fen, state), error) << fen;
+    EXPECT_EQ(state, startState) << fen;
+  }
+
+  // Extra spaces between fields and trailing whitespace are accepted, the counters may be left out.
+  BoardState state{};
+  EXPECT_EQ(BoardState::parseFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR  w KQkq -  0 1 \r\n", state), kFenOk);
+  EXPECT_EQ(state, BoardState::fromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"));
+  EXPECT_EQ(BoardState::parseFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - ", state), kFenOk);
+  EXPECT_EQ(toFenString(state), "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 0");
+}
+
+TEST(TestSearch, TestSmpReachesDepth) {
+  const BoardState state = BoardState::fromFEN("r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10");
+  search::TranspositionTable tt(8, 4);
+  search::SmpSearcher searcher(tt, 4);
+  const search::Result result = searcher.search(state, { .depth = 5 });
+  EXPECT_EQ(result.depth, 5);
+  const MoveList moves = MoveList::fromState(state);
+  EXPECT_NE(std::find(moves.begin(), moves.end(), result.bestMove), moves.end());
+
+  // A mate is found whatever the helpers do.
+  const search::Result mate = searcher.search(BoardState::fromFEN("6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1"), { .depth = 4 });
+  EXPECT_EQ(moveToString(mate.bestMove), "a1a8");
+}
+
+template <size_t depth>
+struct PsqtChecker {
+  template <MoveType moveType>
+  void acceptMove(BoardState state, Move<moveType> move) {
+    state.makeMove(move);
+    EXPECT_EQ(state.psqt_, state.computePsqt());
+    EXPECT_EQ(state.phase_, state.computePhase());
+    EXPECT_EQ(state.mailbox_, state.computeMailbox());
+    if constexpr (depth > 1) {
+      PsqtChecker<depth - 1> checker;
+      state.enumerateMoves<getOtherColor(moveType.color)>(checker);
+    }
+  }
+};
+
+TEST(TestEvaluation, TestIncrementalPsqtAndMailboxMatchFullRecompute) {
+  // Castling, enpassant, promotions and promotion captures all appear within these trees.
+  for (const char* fen : {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+                          "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                          "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - "}) {
+    BoardState state = BoardState::fromFEN(fen);
+    PsqtChecker<3> checker;
+    state.getColor() == kWhite ? state.enumerateMoves<kWhite>(checker) : state.enumerateMoves<kBlack>(checker);
+  }
+}
+
+TEST(TestEvaluation, TestSymmetricPositionsEvaluateEqual) {
+  const BoardState startState = BoardState::fromFEN(uci::kStartFEN);
+  EXPECT_EQ(startState.phase_, kMaxPhase);
+  EXPECT_EQ(search::evaluate(startState), 0);
+
+  // The same position with the colors flipped scores the same for the side to move.
+  const BoardState white = BoardState::fromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+  const BoardState black = BoardState::fromFEN("r3k2r/pppbbppp/2n2q1P/1P2p3/3pn3/BN2PNP1/P1PPQPB1/R3K2R b KQkq - 0 1");
+  EXPECT_NE(search::evaluate(white), 0);
+  EXPECT_EQ(search::evaluate(white), search::evaluate(black));
+}
+
+template <size_t depth>
+struct UnmakeChecker {
+  template <MoveType moveType>
+  void acceptMove(const BoardState& state, Move<moveType> move) {
+    BoardState board = state;
+    UndoRecord undo;
+    board.makeMove(move, undo);
+    BoardState copied = state;
+    copied.makeMove(move);
+    EXPECT_EQ(board, copied);
+    if constexpr (depth > 1) {
+      UnmakeChecker<depth - 1> checker;
+      board.enumerateMoves<getOtherColor(moveType.color)>(checker);
+    }
+    board.unmakeMove(move, undo);
+    EXPECT_EQ(board, state);
+  }
+};
+
+TEST(TestMakeMove, TestUnmakeRestoresState) {
+  for (const char* fen : {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+                          "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                          "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - "}) {
+    BoardState state = BoardState::fromFEN(fen);
+    UnmakeChecker<3> checker;
+    state.getColor() == kWhite ? state.enumerateMoves<kWhite>(checker) : state.enumerateMoves<kBlack>(checker);
+
+    // The encoded moves take the same path.
+    for (PackedMove move : MoveList::fromState(state)) {
+      UndoRecord undo;
+      BoardState board = state;
+      board.makeMove(move, undo);
+      board.unmakeMove(move, undo);
+      EXPECT_EQ(board, state);
+    }
+  }
+}
+
+TEST(TestMakeMove, TestMakeUnmakeMatchesCopyMake) {
+  const BoardState state = BoardState::fromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ");
+  EXPECT_EQ((perft::runPerft<perft::Config{ false, true, false, false, true }, false>(state, 4).nodes), 4085603);
+  perft::HashTable hashTable(1);
+  EXPECT_EQ((perft::runPerft<perft::Config{ false, false, false, true, true }, false>(state, 4, 1, &hashTable).nodes), 4085603);
+
+  search::TranspositionTable tt(4);
+  auto copyMake = std::make_unique<search::Searcher>(tt);
+  const search::Result copied = copyMake->search(state, { .depth = 5 });
+  tt.clear();
+  auto makeUnmake = std::make_unique<search::Searcher>(tt);
+  makeUnmake->setMakeUnmake(true);
+  const search::Result unmade = makeUnmake->search(state, { .depth = 5 });
+  EXPECT_EQ(copied.nodes, unmade.nodes);
+  EXPECT_EQ(copied.pv, unmade.pv);
+}
+
+TEST(TestSee, TestKnownExchanges) {
+  const std::array<std::tuple<const char*, const char*, int32_t>, 9> cases = { {
+    { "1k1r4/1pp4p/p7/4p3/8/P5P1/1PP4P/2K1R3 w - - ", "e1e5", 100 },
+    { "1k1r3q/1ppn3p/p4b2/4p3/8/P2N2P1/1PP1R1BP/2K1Q3 w - - ", "d3e5", -200 },
+    { "4R3/2r3p1/5bk1/1p1r3p/p2PR1P1/P1BK1P2/1P6/8 b - - ", "h5g4", 0 },
+    { "4r1k1/5pp1/nbp4p/1p2p2q/1P2P1b1/1BP2N1P/1B2QPPK/3R4 b - - ", "g4f3", 0 },
+    { "2r1r1k1/pp1bppbp/3p1np1/q3P3/2P2P2/1P2B3/P1N1B1PP/2RQ1RK1 b - - ", "d6e5", 100 },
+    // The second rook recaptures through the first one.
+    { "4r1k1/8/8/4p3/8/8/4R3/4R1K1 w - - 0 1", "e2e5", 100 },
+    { "4r1k1/8/8/4p3/8/8/4R3/6K1 w - - 0 1", "e2e5", -400 },
+    // The knight is pinned to its king and can not recapture.
+    { "8/k7/1n6/3p3R/3B4/8/8/6K1 w - - 0 1", "h5d5", 100 },
+    { "k7/8/1n6/3p3R/3B4/8/8/6K1 w - - 0 1", "h5d5", -400 },
+  } };
+
+  for (const auto& [fen, moveString, score] : cases) {
+    const BoardState state = BoardState::fromFEN(fen);
+    const PackedMove move = state.parseMove(moveString);
+    EXPECT_EQ(state.see(move), score) << fen << ' ' << moveString;
+    EXPECT_TRUE(state.seeGe(move, score)) << fen << ' ' << moveString;
+    EXPECT_FALSE(state.seeGe(move, score + 1)) << fen << ' ' << moveString;
+  }
+}
+
+TEST(TestSee, TestThresholdMatchesExchangeValue) {
+  for (const char* fen : { "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+                           "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 b kq - 0 1",
+                           "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+                           "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3" }) {
+    const BoardState state = BoardState::fromFEN(fen);
+    for (PackedMove move : MoveList::fromState(state)) {
+      const int32_t score = state.see(move);
+      EXPECT_TRUE(state.seeGe(move, score)) << fen << ' ' << moveToString(move);
+      EXPECT_FALSE(state.seeGe(move, score + 1)) << fen << ' ' << moveToString(move);
+    }
+  }
+}
+
+TEST(TestMovePicker, TestIsLegalMatchesGenerator) {
+  const std::array<const char*, 5> fens = {
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 b kq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - ",
+    "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+  };
+
+  // Every move of every position, tried in every position, so most are illegal where they are checked.
+  std::vector<PackedMove> candidates;
+  for (const char* fen : fens) {
+    for (PackedMove move : MoveList::fromState(BoardState::fromFEN(fen))) {
+      candidates.push_back(move);
+    }
+  }
+  for (const char* fen : fens) {
+    const BoardState state = BoardState::fromFEN(fen);
+    const MoveList moves = MoveList::fromState(state);
+    for (PackedMove move : candidates) {
+      const bool isGenerated = std::find(moves.begin(), moves.end(), move) != moves.end();
+      EXPECT_EQ(state.isLegal(move), isGenerated) << fen << ' ' << moveToString(move);
+    }
+    EXPECT_FALSE(state.isLegal(kNullMove));
+  }
+}
+
+TEST(TestMovePicker, TestPicksEveryLegalMoveOnce) {
+  search::HistoryTable history{};
+  for (const char* fen : { "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+                           "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 b kq - 0 1",
+                           "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8" }) {
+    const BoardState state = BoardState::fromFEN(fen);
+    const MoveList moves = MoveList::fromState(state);
+    std::vector<PackedMove> expected(moves.begin(), moves.end());
+    std::sort(expected.begin(), expected.end());
+
+    // Legal, illegal and repeated hash moves and refutations must not change the set of moves.
+    for (uint32_t i = 0; i < moves.size(); i += 7) {
+      const PackedMove hashMove = moves[i];
+      const search::Refutations refutations = { moves[moves.size() - 1 - i], PackedMove(A8, H1, PackedMove::kQuiet), moves[moves.size() - 1 - i] };
+      std::vector<PackedMove> picked;
+      const auto pickAll = [&]<Color our>() {
+        search::MovePicker<our> picker(state, hashMove, refutations, history, i);
+        for (PackedMove move = picker.next(); !move.isNull(); move = picker.next()) {
+          picked.push_back(move);
+        }
+      };
+      state.getColor() == kWhite ? pickAll.template operator()<kWhite>() : pickAll.template operator()<kBlack>();
+
+      ASSERT_FALSE(picked.empty());
+      EXPECT_EQ(picked[0], hashMove);
+      std::sort(picked.begin(), picked.end());
+      EXPECT_EQ(picked, expected) << fen;
+    }
+  }
+}
+
+// Small weights so the accumulators and the output never overflow, as in a trained network.
+std::unique_ptr<nnue::Network> makeRandomNetwork(uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int32_t> distribution(-64, 64);
+  auto network = std::make_unique<nnue::Network>();
+  const auto fill = [&](auto& values) {
+    std::generate(values.begin(), values.end(), [&]() { return static_cast<int16_t>(distribution(rng)); });
+  };
+  fill(network->featureWeights);
+  fill(network->featureBias);
+  fill(network->outputWeights);
+  network->outputBias = static_cast<int16_t>(distribution(rng));
+  return network;
+}
+
+template <size_t depth>
+struct AccumulatorChecker {
+  const nnue::Network& network;
+  const nnue::Accumulator& parent;
+
+  template <MoveType moveType>
+  void acceptMove(const BoardState& state, Move<moveType> move) {
+    nnue::Accumulator updated, refreshed;
+    nnue::update(network, parent, updated, state, PackedMove::fromMove(move));
+    BoardState child = state;
+    child.makeMove(move);
+    nnue::refresh(network, child, refreshed);
+    EXPECT_EQ(updated.values, refreshed.values) << moveToString(PackedMove::fromMove(move));
+    if constexpr (depth > 1) {
+      AccumulatorChecker<depth - 1> checker{ network, updated };
+      child.enumerateMoves<getOtherColor(moveType.color)>(checker);
+    }
+  }
+};
+
+TEST(TestNnue, TestIncrementalUpdateMatchesRefresh) {
+  const std::unique_ptr<nnue::Network> network = makeRandomNetwork(1);
+  // Castling, enpassant, promotions and promotion captures all appear within these trees.
+  for (const char* fen : {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+                          "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                          "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - "}) {
+    const BoardState state = BoardState::fromFEN(fen);
+    nnue::Accumulator root;
+    nnue::refresh(*network, state, root);
+    AccumulatorChecker<2> checker{ *network, root };
+    state.getColor() == kWhite ? state.enumerateMoves<kWhite>(checker) : state.enumerateMoves<kBlack>(checker);
+  }
+}
+
+TEST(TestNnue, TestSimdMatchesScalar) {
+#ifdef __AVX2__
+  const std::unique_ptr<nnue::Network> network = makeRandomNetwork(2);
+  std::mt19937 rng(3);
+  std::uniform_int_distribution<int32_t> distribution(INT16_MIN, INT16_MAX);
+  for (uint32_t round = 0; round < 100; ++round) {
+    // Random inputs reach the clipping bounds and wrap around, both kernels must agree bit for bit.
+    alignas(64) std::array<int16_t, nnue::kHiddenSize> in, scalarOut, simdOut;
+    std::generate(in.begin(), in.end(), [&]() { return static_cast<int16_t>(distribution(rng)); });
+    const auto column = [&]() { return nnue::internal::getColumn(*network, rng() % nnue::kInputSize); };
+    const nnue::internal::Columns<2, 2> columns = { { column(), column() }, { column(), column() } };
+    nnue::internal::applyColumnsScalar(scalarOut.data(), in.data(), columns);
+    nnue::internal::applyColumnsAvx2(simdOut.data(), in.data(), columns);
+    EXPECT_EQ(scalarOut, simdOut);
+    const nnue::internal::Columns<1, 2> captureColumns = { { column() }, { column(), column() } };
+    nnue::internal::applyColumnsScalar(scalarOut.data(), in.data(), captureColumns);
+    nnue::internal::applyColumnsAvx2(simdOut.data(), in.data(), captureColumns);
+    EXPECT_EQ(scalarOut, simdOut);
+    EXPECT_EQ(nnue::internal::dotClippedScalar(in.data(), network->outputWeights.data()),
+              nnue::internal::dotClippedAvx2(in.data(), network->outputWeights.data()));
+  }
+#else
+  GTEST_SKIP() << "built without AVX2";
+#endif
+}
+
+TEST(TestNnue, TestMirroredPositionsEvaluateEqual) {
+  const std::unique_ptr<nnue::Network> network = makeRandomNetwork(4);
+  const BoardState white = BoardState::fromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+  const BoardState black = BoardState::fromFEN("r3k2r/pppbbppp/2n2q1P/1P2p3/3pn3/BN2PNP1/P1PPQPB1/R3K2R b KQkq - 0 1");
+  nnue::Accumulator whiteAccumulator, blackAccumulator;
+  nnue::refresh(*network, white, whiteAccumulator);
+  nnue::refresh(*network, black, blackAccumulator);
+  EXPECT_EQ(nnue::evaluate(*network, whiteAccumulator, kWhite), nnue::evaluate(*network, blackAccumulator, kBlack));
+}
+
+TEST(TestNnue, TestLoadAndSearch) {
+  const std::unique_ptr<nnue::Network> network = makeRandomNetwork(5);
+  const std::string path = (std::filesystem::temp_directory_path() / "kitty_test.nnue").string();
+  {
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(network->featureWeights.data()), sizeof(network->featureWeights));
+    file.write(reinterpret_cast<const char*>(network->featureBias.data()), sizeof(network->featureBias));
+    file.write(reinterpret_cast<const char*>(network->outputWeights.data()), sizeof(network->outputWeights));
+    file.write(reinterpret_cast<const char*>(&network->outputBias), sizeof(network->outputBias));
+  }
+  const std::unique_ptr<nnue::Network> loaded = nnue::Network::load(path);
+  ASSERT_NE(loaded, nullptr);
+  EXPECT_EQ(loaded->featureWeights, network->featureWeights);
+  EXPECT_EQ(loaded->outputWeights, network->outputWeights);
+  EXPECT_EQ(loaded->outputBias, network->outputBias);
+
+  std::filesystem::resize_file(path, sizeof(network->featureWeights));
+  EXPECT_EQ(nnue::Network::load(path), nullptr);
+  std::filesystem::remove(path);
+  EXPECT_EQ(nnue::Network::load(path), nullptr);
+
+  // Whatever the network thinks, a mate is a mate, and make-unmake walks the same tree as copy-make.
+  search::TranspositionTable tt(4);
+  auto searcher = std::make_unique<search::Searcher>(tt);
+  searcher->setNetwork(loaded.get());
+  EXPECT_EQ(moveToString(searcher->search(BoardState::fromFEN("6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1"), { .depth = 4 }).bestMove), "a1a8");
+  const BoardState state = BoardState::fromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ");
+  tt.clear();
+  const search::Result copied = searcher->search(state, { .depth = 4 });
+  tt.clear();
+  searcher->setMakeUnmake(true);
+  const search::Result unmade = searcher->search(state, { .depth = 4 });
+  EXPECT_EQ(copied.pv, unmade.pv);
+  EXPECT_EQ(copied.score, unmade.score);
+}
+
+TEST(TestPerft, TestSuiteReportsMismatchWithDivide) {
+  std::istringstream epd(
+    "# Comments and blank lines are skipped.\n"
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1 ;D1 20 ;D2 400 ;D3 8902\n"
+    "\n"
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ;D1 48 ;D2 2040\n"
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - ;D1 14 ;D2 191 ;D9 1\n"
+    "8/8/8/8/8/8/8/8 w - - ;D1 x\n");
+  std::ostringstream out;
+  const perft::SuiteResult result = perft::runSuite(epd, out, 3, 2);
+  EXPECT_EQ(result.positions, 4);
+  EXPECT_EQ(result.failures, 2);
+  EXPECT_EQ(result.nodes, 20 + 400 + 8902 + 48 + 2039 + 14 + 191);
+
+  // The wrong kiwipete count is reported with the 48 root moves under it, the depth 9 count is beyond the limit.
+  const std::string report = out.str();
+  EXPECT_NE(report.find("line 4: depth 2 expected 2040, got 2039"), std::string::npos);
+  EXPECT_NE(report.find("    e1g1: 43\n"), std::string::npos);
+  EXPECT_NE(report.find("line 6: malformed"), std::string::npos);
+  EXPECT_EQ(report.find("line 5"), std::string::npos);
+}
+
+// Every position two plies from a few roots, covering castle rights lost one square at a time, enpassant and promotions.
+std::vector<BoardState> getPackTestStates() {
+  std::vector<BoardState> states;
+  for (const char* fen : { "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 3 70",
+                           "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                           "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3" }) {
+    const BoardState root = BoardState::fromFEN(fen);
+    for (PackedMove move : MoveList::fromState(root)) {
+      BoardState child = root;
+      child.makeMove(move);
+      for (PackedMove reply : MoveList::fromState(child)) {
+        states.push_back(child);
+        states.back().makeMove(reply);
+      }
+    }
+  }
+  return states;
+}
+
+TEST(TestPackedPosition, TestRoundTrip) {
+  for (BoardState state : getPackTestStates()) {
+    packed::PackedPosition position;
+    ASSERT_TRUE(packed::pack(state, position));
+    BoardState unpacked{};
+    ASSERT_TRUE(packed::unpack(position, unpacked));
+    EXPECT_EQ(unpacked, state) << toFenString(state);
+  }
+
+  // Nothing past 32 pieces, no unknown piece codes, and the same checks as parseFEN.
+  BoardState state = BoardState::fromFEN(uci::kStartFEN);
+  packed::PackedPosition position;
+  ASSERT_TRUE(packed::pack(state, position));
+  BoardState unpacked = state;
+  packed::PackedPosition corrupted = position;
+  corrupted.pieces[0] |= 0xF;
+  EXPECT_FALSE(packed::unpack(corrupted, unpacked));
+  corrupted = position;
+  corrupted.enpassant = E3;
+  EXPECT_FALSE(packed::unpack(corrupted, unpacked));
+  corrupted = position;
+  corrupted.occupancy |= toBitboard(E4);
+  EXPECT_FALSE(packed::unpack(corrupted, unpacked));
+  EXPECT_EQ(unpacked, state);
+  state.fullmove_ = 70000;
+  ASSERT_TRUE(packed::pack(state, position));
+  ASSERT_TRUE(packed::unpack(position, unpacked));
+  EXPECT_EQ(unpacked.fullmove_, UINT16_MAX);
+  state.bitboards_[kWhite][kKnight] |= kRank3Mask;
+  state.mailbox_ = state.computeMailbox();
+  EXPECT_FALSE(packed::pack(state, position));
+}
+
+TEST(TestPackedPosition, TestWriteAndMapByteRanges) {
+  const std::vector<BoardState> states = getPackTestStates();
+  const std::string path = (std::filesystem::temp_directory_path() / "kitty_test.positions").string();
+  {
+    packed::PositionWriter writer(path);
+    ASSERT_TRUE(writer.isOpen());
+    for (const BoardState& state : states) {
+      ASSERT_TRUE(writer.write(state));
+    }
+    EXPECT_TRUE(writer.flush());
+    EXPECT_EQ(writer.getCount(), states.size());
+  }
+  {
+    // A torn record at the end is left out.
+    std::ofstream file(path, std::ios::binary | std::ios::app);
+    file.write("torn", 4);
+  }
+
+  const std::unique_ptr<packed::MappedPositionFile> file = packed::MappedPositionFile::open(path);
+  ASSERT_NE(file, nullptr);
+  ASSERT_EQ(file->size(), states.size());
+
+  // Cut at arbitrary byte offsets, each record must be read by exactly one of the threads, in order.
+  constexpr uint64_t kThreadCount = 3;
+  std::array<std::vector<BoardState>, kThreadCount> parts;
+  std::vector<std::thread> threads;
+  for (uint64_t i = 0; i < kThreadCount; ++i) {
+    threads.emplace_back([&, i]() {
+      const uint64_t begin = file->getByteSize() * i / kThreadCount + 7;
+      const uint64_t end = (i + 1 == kThreadCount ? file->getByteSize() : file->getByteSize() * (i + 1) / kThreadCount + 7);
+      BoardState state{};
+      for (const packed::PackedPosition& position : file->getByteRange(i == 0 ? 0 : begin, end)) {
+        EXPECT_TRUE(packed::unpack(position, state));
+        parts[i].push_back(state);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  std::vector<BoardState> read;
+  for (const std::vector<BoardState>& part : parts) {
+    EXPECT_FALSE(part.empty());
+    read.insert(read.end(), part.begin(), part.end());
+  }
+  EXPECT_EQ(read, states);
+
+  std::filesystem::remove(path);
+  EXPECT_EQ(packed::MappedPositionFile::open(path), nullptr);
+}
+
+// http://hgm.nubati.net/book_format.html
+TEST(TestPolyglot, TestReferenceKeys) {
+  const std::vector<std::pair<const char*, uint64_t>> positions = {
+    { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 0x463b96181691fc9cull },
+    { "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1", 0x823c9b50fd114196ull },
+    { "rnbqkbnr/ppp1pppp/8/3p4/4P3/8/PPPP1PPP/RNBQKBNR w KQkq d6 0 2", 0x0756b94461c50fb0ull },
+    { "rnbqkbnr/ppp1pppp/8/3pP3/8/8/PPPP1PPP/RNBQKBNR b KQkq - 0 2", 0x662fafb965db29d4ull },
+    { "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3", 0x22a48b5a8e47ff78ull },
+    { "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR b kq - 0 3", 0x652a607ca3f242c1ull },
+    { "rnbq1bnr/ppp1pkpp/8/3pPp2/8/8/PPPPKPPP/RNBQ1BNR w - - 0 4", 0x00fdd303c946bdd9ull },
+    { "rnbqkbnr/p1pppppp/8/8/PpP4P/8/1P1PPPP1/RNBQKBNR b KQkq c3 0 3", 0x3c8123ea7b067637ull },
+    { "rnbqkbnr/p1pppppp/8/8/P6P/R1p5/1P1PPPP1/1NBQKBNR b Kkq - 0 4", 0x5c3f9b829b279560ull },
+  };
+  for (const auto& [fen, key] : positions) {
+    EXPECT_EQ(polyglot::getKey(BoardState::fromFEN(fen)), key) << fen;
+  }
+}
+
+TEST(TestPolyglot, TestProbeMapsLegalMoves) {
+  const BoardState startState = BoardState::fromFEN(uci::kStartFEN);
+  const BoardState castleState = BoardState::fromFEN("r3k2r/1P6/8/8/8/8/8/R3K2R w KQkq - 0 1");
+  const uint64_t startKey = polyglot::getKey(startState);
+  const uint64_t castleKey = polyglot::getKey(castleState);
+  // From square << 6 | to square, both counted from a1.
+  const auto encode = [](const char* move) {
+    return static_cast<uint16_t>(((move[1] - '1') * 8 + (move[0] - 'a')) << 6 | ((move[3] - '1') * 8 + (move[2] - 'a')));
+  };
+  const std::string path = (std::filesystem::temp_directory_path() / "kitty_test.bin").string();
+  ASSERT_TRUE(polyglot::writeBook(path, {
+    { castleKey, encode("e1h1"), 1, 0 },
+    { startKey, encode("e2e4"), 3, 0 },
+    { startKey, encode("e2e5"), 100, 0 },  // Not legal, skipped.
+    { startKey, encode("g1f3"), 0, 0 },    // Never played.
+    { startKey, encode("d2d4"), 1, 0 },
+    { castleKey, encode("e1a1"), 1, 0 },
+    { castleKey, static_cast<uint16_t>(4 << 12 | encode("b7b8")), 2, 0 },
+  }));
+
+  const std::unique_ptr<polyglot::Book> book = polyglot::Book::open(path);
+  ASSERT_NE(book, nullptr);
+  EXPECT_EQ(book->size(), 7);
+  for (uint64_t random : { 0, 1, 2, 4, 6 }) {
+    EXPECT_EQ(moveToString(book->probe(startState, random)), "e2e4");
+  }
+  EXPECT_EQ(moveToString(book->probe(startState, 3)), "d2d4");
+  EXPECT_EQ(moveToString(book->probe(castleState, 0)), "e1g1");
+  EXPECT_EQ(moveToString(book->probe(castleState, 1)), "e1c1");
+  EXPECT_EQ(moveToString(book->probe(castleState, 2)), "b7b8q");
+  EXPECT_TRUE(book->probe(BoardState::fromFEN("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - "), 0).isNull());
+
+  std::ostringstream out;
+  {
+    uci::Engine engine(out);
+    EXPECT_TRUE(engine.execute("setoption name BookFile value " + path));
+    EXPECT_TRUE(engine.execute("position startpos"));
+    EXPECT_TRUE(engine.execute("go wtime 1000 btime 1000"));
+    engine.wait();
+  }
+  EXPECT_TRUE(out.str().find("bestmove e2e4") != std::string::npos || out.str().find("bestmove d2d4") != std::string::npos) << out.str();
+  EXPECT_EQ(out.str().find("info depth"), std::string::npos);
+
+  std::filesystem::remove(path);
+  EXPECT_EQ(polyglot::Book::open(path), nullptr);
+}
+
+TEST(TestBitbase, TestKnownPositions) {
+  const bitbase::Tables& tables = bitbase::getTables();
+  const std::vector<std::pair<const char*, bitbase::Result>> positions = {
+    { "4k3/8/4K3/4P3/8/8/8/8 w - - 0 1", bitbase::kWinResult },
+    { "4k3/8/4K3/4P3/8/8/8/8 b - - 0 1", bitbase::kLossResult },
+    { "8/8/8/8/8/4k3/4P3/4K3 w - - 0 1", bitbase::kDrawResult },
+    { "k7/8/8/P7/8/8/8/K7 w - - 0 1", bitbase::kDrawResult },
+    { "8/8/8/8/8/2k5/8/K6r w - - 0 1", bitbase::kLossResult },
+    { "8/8/8/8/8/8/1q6/K1k5 w - - 0 1", bitbase::kLossResult },
+    { "8/8/8/8/8/8/1q6/K6k w - - 0 1", bitbase::kDrawResult },
+    { "7k/5Q2/6K1/8/8/8/8/8 b - - 0 1", bitbase::kDrawResult },
+    { "8/8/8/8/8/8/1n6/K6k w - - 0 1", bitbase::kDrawResult },
+    { "8/8/8/8/8/8/8/K6k w - - 0 1", bitbase::kDrawResult },
+    { "8/8/8/8/8/8/PP6/K6k w - - 0 1", bitbase::kNoResult },
+  };
+  for (const auto& [fen, result] : positions) {
+    EXPECT_EQ(tables.probe(BoardState::fromFEN(fen)), result) << fen;
+  }
+}
+
+// Every legal position of every set, with either side as the strong side, agrees with the results of its moves.
+TEST(TestBitbase, TestResultsFollowFromMoves) {
+  const bitbase::Tables& tables = bitbase::getTables();
+  for (uint32_t material = 0; material < bitbase::kMaterialSize; ++material) {
+    const Piece piece = bitbase::kStrongPieces[material];
+    for (Square strongKing = 0; strongKing < kSquareSize; ++strongKing) {
+      for (Square pieceSq = (piece == kPawn ? 8 : 0); pieceSq < (piece == kPawn ? 56 : kSquareSize); ++pieceSq) {
+        for (Square weakKing = 0; weakKing < kSquareSize; ++weakKing) {
+          if (strongKing == pieceSq || pieceSq == weakKing || isSquareSet(getAttack<kKing>(strongKing) | toBitboard(strongKing), weakKing)) {
+            continue;
+          }
+          for (const auto& [strong, color] : { std::pair{ kWhite, kWhite }, { kWhite, kBlack }, { kBlack, kWhite }, { kBlack, kBlack } }) {
+            BoardState state{};
+            state.enpassant_ = NO_SQUARE;
+            state.color_ = color;
+            const Square flip = (strong == kWhite ? 0 : 56);
+            state.bitboards_[strong][kKing] = toBitboard(strongKing ^ flip);
+            state.bitboards_[strong][piece] = toBitboard(pieceSq ^ flip);
+            state.bitboards_[strong ^ 1][kKing] = toBitboard(weakKing ^ flip);
+            state.mailbox_ = state.computeMailbox();
+            if (color == kWhite ? state.isInCheck<kBlack>() : state.isInCheck<kWhite>()) {
+              continue;
+            }
+
+            bool hasWinningMove = false;
+            bool isEveryMoveLosing = true;
+            const MoveList moves = MoveList::fromState(state);
+            for (PackedMove move : moves) {
+              BoardState child = state;
+              child.makeMove(move);
+              const bitbase::Result childResult = tables.probe(child);
+              hasWinningMove = hasWinningMove || childResult == bitbase::kLossResult;
+              isEveryMoveLosing = isEveryMoveLosing && childResult == bitbase::kWinResult;
+            }
+            const bool isMated = moves.empty() && (color == kWhite ? state.isInCheck<kWhite>() : state.isInCheck<kBlack>());
+            const bitbase::Result expected = (hasWinningMove ? bitbase::kWinResult : isMated || (!moves.empty() && isEveryMoveLosing) ? bitbase::kLossResult : bitbase::kDrawResult);
+            ASSERT_EQ(tables.probe(state), expected) << bitbase::kMaterialNames[material] << " " << toFenString(state);
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(TestBitbase, TestGenerationIsDeterministicAndLoads) {
+  const bitbase::Tables& tables = bitbase::getTables();
+  const bitbase::Tables generated = bitbase::Tables::generate(3);
+  bitbase::Tables loaded;
+  EXPECT_EQ(loaded.probe(BoardState::fromFEN("4k3/8/4K3/4P3/8/8/8/8 w - - 0 1")), bitbase::kNoResult);
+  for (uint32_t material = 0; material < bitbase::kMaterialSize; ++material) {
+    const bitbase::Material set = static_cast<bitbase::Material>(material);
+    EXPECT_EQ(tables.getWords(set).size(), bitbase::getIndexSize(set) / 64);
+    EXPECT_TRUE(std::ranges::equal(tables.getWords(set), generated.getWords(set)));
+    EXPECT_FALSE(loaded.load(set, tables.getWords(set).first(1)));
+    EXPECT_TRUE(loaded.load(set, tables.getWords(set)));
+  }
+  EXPECT_EQ(loaded.probe(BoardState::fromFEN("4k3/8/4K3/4P3/8/8/8/8 w - - 0 1")), bitbase::kWinResult);
+
+  std::ostringstream source;
+  tables.writeSource(source);
+  EXPECT_NE(source.str().find("inline constexpr std::array<uint64_t, 3072> kKpkWords = {"), std::string::npos);
+  EXPECT_NE(source.str().find("inline constexpr std::array<uint64_t, 1280> kKqkWords = {"), std::string::npos);
+}
+
+TEST(TestSearch, TestBitbaseDrawScoresZero) {
+  // The pawn is up by material, but the defending king holds the draw. At depth 1 the replies are quiescence leaves.
+  for (uint32_t depth : { 1, 8 }) {
+    const search::Result result = search::search(BoardState::fromFEN("8/8/8/8/8/4k3/4P3/4K3 w - - 0 1"), { .depth = depth });
+    EXPECT_EQ(result.score, 0) << depth;
+    EXPECT_FALSE(result.bestMove.isNull());
+  }
+}
+
+TEST(TestUci, TestRejectsIllegalMoves) {
+  // Each line stops at the illegal move and keeps the moves before it, 29 replies after 1. e4 e5 and 20 from the start.
+  for (const auto& [moves, illegal, nodes] : { std::tuple{ "e2e5", "e2e5", 20 }, { "e2e4 e7e5 g1f3q", "g1f3q", 29 },
+                                                { "e2e4 e7e5 e4e5 d2d4", "e4e5", 29 }, { "e2e4 e7e5 e1g1", "e1g1", 29 },
+                                                { "e2e4q", "e2e4q", 20 }, { "e2e4 e7e5 e1e2q", "e1e2q", 29 },
+                                                { "e2e4 e7e5 e8e7", "e8e7", 29 } }) {
+    std::ostringstream out;
+    uci::Engine engine(out);
+    EXPECT_TRUE(engine.execute(std::format("position startpos moves {} a2a3", moves)));
+    EXPECT_TRUE(engine.execute("go perft 1"));
+    engine.wait();
+    EXPECT_NE(out.str().find(std::format("info string invalid move {}\n", illegal)), std::string::npos) << moves;
+    EXPECT_NE(out.str().find(std::format("Nodes searched: {}\n", nodes)), std::string::npos) << moves;
+  }
+}
+
+TEST(TestUci, TestStopInterruptsPerft) {
+  // Perft 7 from the start runs for seconds, stop and isready must not wait for it.
+  std::ostringstream out;
+  uci::Engine engine(out);
+  EXPECT_TRUE(engine.execute("go perft 7"));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  const auto start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(engine.execute("stop"));
+  EXPECT_TRUE(engine.execute("isready"));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(200));
+  EXPECT_NE(out.str().find("readyok"), std::string::npos);
+  EXPECT_EQ(out.str().find("Nodes searched: 3195901860"), std::string::npos);
+}
+
+TEST(TestSearch, TestGameHistoryRepetitionScoresZero) {
+  // Black is a queen down, but Kb8 repeats the position after the first move of the game.
+  const char* fen = "k7/8/8/8/8/7Q/8/K7 b - - 0 1";
+  BoardState state = BoardState::fromFEN(fen);
+  std::vector<uint64_t> history;
+  for (const char* move : { "a8b8", "h3h4", "b8a8", "h4h3" }) {
+    history.push_back(state.key_);
+    state.makeMove(state.parseMove(move));
+  }
+  EXPECT_LT(search::search(state, { .depth = 5 }).score, -500);
+  const search::Result result = search::search(state, { .depth = 5, .history = history });
+  EXPECT_EQ(result.score, 0);
+  EXPECT_EQ(moveToString(result.bestMove), "a8b8");
+
+  std::ostringstream out;
+  {
+    uci::Engine engine(out);
+    EXPECT_TRUE(engine.execute(std::format("position fen {} moves a8b8 h3h4 b8a8 h4h3", fen)));
+    EXPECT_TRUE(engine.execute("position fen k7/8/8 b - - 0 1"));  // Invalid, the position and its history stay.
+    EXPECT_TRUE(engine.execute("go depth 5"));
+    engine.wait();
+  }
+  EXPECT_NE(out.str().find("info string invalid fen"), std::string::npos);
+  EXPECT_NE(out.str().find("info depth 5 score cp 0 "), std::string::npos);
+  EXPECT_NE(out.str().find("bestmove a8b8"), std::string::npos);
+}
+
+TEST(TestUci, TestInfiniteWaitsForStop) {
+  // The mate in one ends the search at once, but bestmove must still wait for stop.
+  std::ostringstream out;
+  uci::Engine engine(out);
+  EXPECT_TRUE(engine.execute("position fen 6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1"));
+  EXPECT_TRUE(engine.execute("go infinite"));
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_TRUE(engine.execute("isready"));
+  EXPECT_NE(out.str().find("readyok"), std::string::npos);
+  EXPECT_EQ(out.str().find("bestmove"), std::string::npos);
+  EXPECT_TRUE(engine.execute("stop"));
+  EXPECT_NE(out.str().find("bestmove a1a8"), std::string::npos);
+}
@@ -0,0 +1,508 @@
+#pragma once
+#include "bitbase.h"
+#include "bitboard.h"
+#include "instrumentation.h"
+#include "move_list.h"
+#include "nnue.h"
+#include "perft_driver.h"
+#include "polyglot.h"
+#include "search.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+  namespace internal {
+    struct SliderQuery {
+      Square square;
+      Bitboard occupancy;
+    };
+
+    inline std::vector<SliderQuery> generateSliderQueries(size_t count) {
+      // Sparse random occupancy, close to the density of a middlegame board.
+      std::mt19937_64 rng(0x4b69747479);
+      std::vector<SliderQuery> queries(count);
+      for (SliderQuery& query : queries) {
+        query.square = static_cast<Square>(rng() % kSquareSize);
+        query.occupancy = rng() & rng() & rng();
+      }
+      return queries;
+    }
+
+    // Return nanoseconds per lookup. The checksum keeps the lookups from being optimized away.
+    template <typename Lookup>
+    inline double timeLookups(const std::vector<SliderQuery>& queries, uint32_t rounds, Bitboard& checksum, Lookup lookup) {
+      using namespace std::chrono;
+      auto start = high_resolution_clock::now();
+      for (uint32_t round = 0; round < rounds; ++round) {
+        for (const SliderQuery& query : queries) {
+          checksum ^= lookup(query.square, query.occupancy ^ checksum);
+        }
+      }
+      auto end = high_resolution_clock::now();
+      return static_cast<double>(duration_cast<nanoseconds>(end - start).count()) / (static_cast<double>(queries.size()) * rounds);
+    }
+  }
+
+  // Compare the magic bitboard and PEXT slider attack backends on this machine.
+  inline void runSliderAttackBenchmark() {
+    using std::cout;
+    using std::format;
+
+    constexpr uint32_t kRounds = 200;
+    const std::vector<internal::SliderQuery> queries = internal::generateSliderQueries(1 << 16);
+    Bitboard checksum = 0;
+
+#ifdef KITTY_ENABLE_PEXT
+    cout << "slider backend: pext\n";
+#else
+    cout << "slider backend: magic (built without KITTY_ENABLE_PEXT)\n";
+#endif
+
+    double bishopMagic = internal::timeLookups(queries, kRounds, checksum, [](Square square, Bitboard occupancy) {
+      return ::internal::sliderAttackTables[square][0].getAttack<kBishop>(occupancy);
+    });
+    double rookMagic = internal::timeLookups(queries, kRounds, checksum, [](Square square, Bitboard occupancy) {
+      return ::internal::sliderAttackTables[square][1].getAttack<kRook>(occupancy);
+    });
+    cout << format("magic  bishop {:.3f} ns, rook {:.3f} ns\n", bishopMagic, rookMagic);
+
+#ifdef KITTY_ENABLE_PEXT
+    double bishopPext = internal::timeLookups(queries, kRounds, checksum, [](Square square, Bitboard occupancy) {
+      return ::internal::sliderAttackTables[square][0].getPextAttack(occupancy);
+    });
+    double rookPext = internal::timeLookups(queries, kRounds, checksum, [](Square square, Bitboard occupancy) {
+      return ::internal::sliderAttackTables[square][1].getPextAttack(occupancy);
+    });
+    cout << format("pext   bishop {:.3f} ns, rook {:.3f} ns\n", bishopPext, rookPext);
+#endif
+
+    cout << format("checksum {:#018x}\n\n", checksum);
+  }
+
+  // Time to depth of the lazy SMP search against the single thread search, summed over the perft positions.
+  // Each run starts from a cleared table so the thread counts are compared fairly.
+  inline void runSmpBenchmark(uint32_t depth) {
+    using std::cout;
+    using std::format;
+    using namespace std::chrono;
+
+    const std::array<const char*, 6> fens = {
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+      "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - ",
+      "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+      "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+      "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    };
+
+    search::TranspositionTable tt(256);
+    double baseTime = 0.0;
+    for (uint32_t threadCount : { 1, 2, 4, 8, 16, 32 }) {
+      search::SmpSearcher searcher(tt, threadCount);
+      uint64_t nodes = 0;
+      double time = 0.0;
+      for (const char* fen : fens) {
+        tt.clear(threadCount);
+        auto start = steady_clock::now();
+        nodes += searcher.search(BoardState::fromFEN(fen), { .depth = depth }).nodes;
+        time += duration<double, std::milli>(steady_clock::now() - start).count();
+      }
+      baseTime = (threadCount == 1 ? time : baseTime);
+      cout << format("threads {:2}, depth {}, nodes {:10}, time {:8.1f} ms, speedup {:.2f}\n", threadCount, depth, nodes, time, baseTime / time);
+    }
+  }
+
+  // Copy-make into the per ply stack against make-unmake with an undo record, in perft and in search.
+  inline void runMakeMoveBenchmark() {
+    using std::cout;
+    using std::format;
+    using namespace std::chrono;
+
+    const std::array<std::pair<const char*, uint32_t>, 3> perftCases = { {
+      { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 6 },
+      { "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ", 5 },
+      { "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - ", 7 },
+    } };
+
+    const auto timePerft = [&]<perft::Config config>() {
+      auto start = steady_clock::now();
+      uint64_t nodes = 0;
+      for (const auto& [fen, depth] : perftCases) {
+        nodes += perft::runPerft<config, false>(BoardState::fromFEN(fen), depth, 1).nodes;
+      }
+      return std::pair(nodes, duration<double, std::milli>(steady_clock::now() - start).count());
+    };
+
+    for (uint32_t round = 0; round < 2; ++round) {
+      auto [copyNodes, copyTime] = timePerft.template operator()<perft::Config{ false, false, false, false, false }>();
+      auto [undoNodes, undoTime] = timePerft.template operator()<perft::Config{ false, false, false, false, true }>();
+      cout << format("perft  copy-make {} nodes {:.1f} ms, make-unmake {} nodes {:.1f} ms\n", copyNodes, copyTime, undoNodes, undoTime);
+    }
+
+    search::TranspositionTable tt(64);
+    for (uint32_t round = 0; round < 2; ++round) {
+      for (bool isMakeUnmake : { false, true }) {
+        auto searcher = std::make_unique<search::Searcher>(tt);
+        searcher->setMakeUnmake(isMakeUnmake);
+        uint64_t nodes = 0;
+        auto start = steady_clock::now();
+        for (const auto& [fen, depth] : perftCases) {
+          tt.clear();
+          nodes += searcher->search(BoardState::fromFEN(fen), { .depth = 8 }).nodes;
+        }
+        const double time = duration<double, std::milli>(steady_clock::now() - start).count();
+        cout << format("search {} {} nodes {:.1f} ms\n", isMakeUnmake ? "make-unmake" : "copy-make  ", nodes, time);
+      }
+    }
+  }
+
+  // Quiescence at the leaves against plain fixed depth, one and two plies deeper, over the same positions.
+  inline void runQuiescenceBenchmark(uint32_t depth) {
+    using std::cout;
+    using std::format;
+    using namespace std::chrono;
+
+    const std::array<const char*, 6> fens = {
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+      "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - ",
+      "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+      "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+      "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    };
+
+    search::TranspositionTable tt(64);
+    const auto run = [&](bool isQuiescence, uint32_t runDepth) {
+      auto searcher = std::make_unique<search::Searcher>(tt);
+      searcher->setQuiescence(isQuiescence);
+      uint64_t nodes = 0;
+      uint64_t quiescenceNodes = 0;
+      auto start = steady_clock::now();
+      for (const char* fen : fens) {
+        tt.clear();
+        const search::Result result = searcher->search(BoardState::fromFEN(fen), { .depth = runDepth });
+        nodes += result.nodes;
+        quiescenceNodes += result.quiescenceNodes;
+      }
+      const double time = duration<double, std::milli>(steady_clock::now() - start).count();
+      cout << format("{} depth {}, nodes {}, quiescence {:.1f}%, time {:.1f} ms\n", isQuiescence ? "quiescence" : "plain     ",
+                     runDepth, nodes, 100.0 * static_cast<double>(quiescenceNodes) / static_cast<double>(std::max<uint64_t>(nodes, 1)), time);
+    };
+
+    run(true, depth);
+    for (uint32_t extra = 0; extra <= 2; ++extra) {
+      run(false, depth + extra);
+    }
+  }
+
+  // Where perft spends its cycles over the perft positions, sampling the generator speed every second meanwhile.
+  inline void runInstrumentationBenchmark(uint32_t depth) {
+#ifdef KITTY_ENABLE_INSTRUMENTATION
+    using std::cout;
+    using std::format;
+
+    instrumentation::reset();
+    uint64_t nodes = 0;
+    {
+      instrumentation::ProgressSampler sampler(cout, std::chrono::seconds(1), []() { return instrumentation::getSnapshot().nodes[instrumentation::kNodeCounter]; });
+      for (const char* fen : { "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+                               "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+                               "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - ",
+                               "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                               "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+                               "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10" }) {
+        nodes += perft::runPerft<perft::Config{ true, true, false }>(BoardState::fromFEN(fen), depth).nodes;
+      }
+    }
+    cout << format("perft nodes {}\n", nodes);
+    instrumentation::printReport(cout, instrumentation::getSnapshot());
+#else
+    (void)depth;
+    std::cout << "built without KITTY_ENABLE_INSTRUMENTATION\n";
+#endif
+  }
+
+  // Find the captured piece by scanning their bitboards, against one mailbox load, then time whole capture moves.
+  inline void runCaptureBenchmark() {
+    using std::cout;
+    using std::format;
+    using namespace std::chrono;
+
+    struct Capture {
+      BoardState state;
+      PackedMove move;
+    };
+    std::vector<Capture> captures;
+    for (const char* fen : { "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+                             "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                             "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10" }) {
+      const BoardState state = BoardState::fromFEN(fen);
+      for (PackedMove move : MoveList::fromState<kCaptureMoves>(state)) {
+        captures.push_back({ state, move });
+      }
+    }
+
+    constexpr uint32_t kRounds = 200000;
+    uint64_t checksum = 0;
+    const auto time = [&](auto lookup) {
+      auto start = high_resolution_clock::now();
+      for (uint32_t round = 0; round < kRounds; ++round) {
+        for (const Capture& capture : captures) {
+          checksum += lookup(capture);
+        }
+      }
+      return static_cast<double>(duration_cast<nanoseconds>(high_resolution_clock::now() - start).count()) / (static_cast<double>(captures.size()) * kRounds);
+    };
+
+    const double scan = time([](const Capture& capture) -> Piece {
+      const Color their = (capture.state.getColor() == kWhite ? kBlack : kWhite);
+      for (Piece piece : { kPawn, kKnight, kBishop, kRook, kQueen }) {
+        if (isSquareSet(capture.state.bitboards_[their][piece], capture.move.getDest())) {
+          return piece;
+        }
+      }
+      return kNoPiece;
+    });
+    const double mailbox = time([](const Capture& capture) -> Piece {
+      return capture.state.getPieceAt(capture.move.getDest());
+    });
+    const double makeMove = time([](const Capture& capture) {
+      BoardState child = capture.state;
+      child.makeMove(capture.move);
+      return child.key_;
+    });
+    cout << format("{} captures, scan {:.2f} ns, mailbox {:.2f} ns, make capture {:.2f} ns, checksum {:#x}\n", captures.size(), scan, mailbox, makeMove, checksum);
+  }
+
+  // Exchange evaluations per second over every legal move of the test positions, the full value and the threshold test.
+  inline void runSeeBenchmark() {
+    using std::cout;
+    using std::format;
+    using namespace std::chrono;
+
+    struct Exchange {
+      BoardState state;
+      PackedMove move;
+    };
+    std::vector<Exchange> exchanges;
+    for (const char* fen : { "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+                             "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                             "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+                             "2r1r1k1/pp1bppbp/3p1np1/q3P3/2P2P2/1P2B3/P1N1B1PP/2RQ1RK1 b - - " }) {
+      const BoardState state = BoardState::fromFEN(fen);
+      for (PackedMove move : MoveList::fromState(state)) {
+        exchanges.push_back({ state, move });
+      }
+    }
+
+    constexpr uint32_t kRounds = 20000;
+    int64_t checksum = 0;
+    const auto time = [&](auto evaluate) {
+      auto start = high_resolution_clock::now();
+      for (uint32_t round = 0; round < kRounds; ++round) {
+        for (const Exchange& exchange : exchanges) {
+          checksum += evaluate(exchange);
+        }
+      }
+      return static_cast<double>(duration_cast<nanoseconds>(high_resolution_clock::now() - start).count()) / (static_cast<double>(exchanges.size()) * kRounds);
+    };
+
+    const double see = time([](const Exchange& exchange) { return exchange.state.see(exchange.move); });
+    const double seeGe = time([](const Exchange& exchange) { return static_cast<int32_t>(exchange.state.seeGe(exchange.move, 0)); });
+    cout << format("{} moves, see {:.2f} ns ({:.1f} M/s), seeGe {:.2f} ns ({:.1f} M/s), checksum {}\n",
+                   exchanges.size(), see, 1000.0 / see, seeGe, 1000.0 / seeGe, checksum);
+  }
+
+  // Accumulator update and output layer, scalar against AVX2, then the search speed with and without the network.
+  // Without a weights file the network is random, which costs the same to run.
+  inline void runNnueBenchmark(const std::string& path) {
+    using std::cout;
+    using std::format;
+    using namespace std::chrono;
+
+    std::unique_ptr<nnue::Network> network = (path.empty() ? nullptr : nnue::Network::load(path));
+    if (!network) {
+      std::mt19937 rng(0x4b69747479);
+      network = std::make_unique<nnue::Network>();
+      for (int16_t& weight : network->featureWeights) {
+        weight = static_cast<int16_t>(rng() % 129) - 64;
+      }
+      for (int16_t& weight : network->outputWeights) {
+        weight = static_cast<int16_t>(rng() % 129) - 64;
+      }
+    }
+
+    const BoardState state = BoardState::fromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ");
+    const MoveList moves = MoveList::fromState(state);
+    nnue::Accumulator parent, child;
+    nnue::refresh(*network, state, parent);
+
+    constexpr uint32_t kRounds = 100000;
+    int64_t checksum = 0;
+    const auto time = [&](auto apply, auto dot) {
+      auto start = high_resolution_clock::now();
+      for (uint32_t round = 0; round < kRounds; ++round) {
+        for (PackedMove move : moves) {
+          // The columns update() would pick for a knight move, through the given kernel.
+          const nnue::internal::Columns<1, 1> columns = { { nnue::internal::getColumn(*network, nnue::getFeatureIndex(kWhite, kWhite, kKnight, move.getDest())) },
+                                                          { nnue::internal::getColumn(*network, nnue::getFeatureIndex(kWhite, kWhite, kKnight, move.getSrce())) } };
+          for (Color perspective : { kWhite, kBlack }) {
+            apply(child.values[perspective].data(), parent.values[perspective].data(), columns);
+          }
+          checksum += dot(child.values[kWhite].data(), network->outputWeights.data()) + dot(child.values[kBlack].data(), network->outputWeights.data() + nnue::kHiddenSize);
+        }
+      }
+      return static_cast<double>(duration_cast<nanoseconds>(high_resolution_clock::now() - start).count()) / (static_cast<double>(moves.size()) * kRounds);
+    };
+
+#ifdef __AVX2__
+    const double simd = time(nnue::internal::applyColumnsAvx2<1, 1>, nnue::internal::dotClippedAvx2);
+    const double scalar = time(nnue::internal::applyColumnsScalar<1, 1>, nnue::internal::dotClippedScalar);
+    cout << format("update and evaluate, scalar {:.1f} ns, avx2 {:.1f} ns, checksum {}\n", scalar, simd, checksum);
+#else
+    const double scalar = time(nnue::internal::applyColumnsScalar<1, 1>, nnue::internal::dotClippedScalar);
+    cout << format("update and evaluate, scalar {:.1f} ns (built without avx2), checksum {}\n", scalar, checksum);
+#endif
+
+    search::TranspositionTable tt(64);
+    for (const nnue::Network* evaluator : { static_cast<const nnue::Network*>(nullptr), static_cast<const nnue::Network*>(network.get()) }) {
+      auto searcher = std::make_unique<search::Searcher>(tt);
+      searcher->setNetwork(evaluator);
+      tt.clear();
+      const search::Result result = searcher->search(state, { .depth = 7 });
+      cout << format("search {} depth {}, nodes {}, time {} ms, speed {} knps\n", evaluator ? "nnue" : "psqt", result.depth, result.nodes, result.time.count(), result.nps / 1000);
+    }
+  }
+
+  namespace internal {
+    // Every position above the depth, with the move to each child.
+    inline void collectBookEntries(const BoardState& state, uint32_t depth, std::vector<BoardState>& states, std::vector<polyglot::BookEntry>& entries) {
+      if (depth == 0) {
+        return;
+      }
+      states.push_back(state);
+      const uint64_t key = polyglot::getKey(state);
+      for (PackedMove move : MoveList::fromState(state)) {
+        entries.push_back({ key, polyglot::toBookMove(move), static_cast<uint16_t>(1 + entries.size() % 16), 0 });
+        BoardState child = state;
+        child.makeMove(move);
+        collectBookEntries(child, depth - 1, states, entries);
+      }
+    }
+
+    // Ask the OS to drop the file from the page cache, so the next reads go to the disk.
+    inline bool evictFromPageCache([[maybe_unused]] const std::string& path) {
+#ifdef __linux__
+      const int descriptor = ::open(path.c_str(), O_RDONLY);
+      if (descriptor < 0) {
+        return false;
+      }
+      const bool isEvicted = posix_fadvise(descriptor, 0, 0, POSIX_FADV_DONTNEED) == 0;
+      close(descriptor);
+      return isEvicted;
+#else
+      return false;
+#endif
+    }
+  }
+
+  // Book probe latency with the book cold, its pages evicted from the page cache before every probe.
+  // The warm probe is BM_BookProbe in KittyEngineBenchmark.
+  // Without a book file, every position up to 3 plies from the start and all its moves make a 3 MB book.
+  // The positions probed are those positions, so every probe is a hit and maps a move, the slower case.
+  inline void runBookBenchmark(const std::string& path) {
+    using std::cout;
+    using std::format;
+    using namespace std::chrono;
+
+    std::vector<BoardState> states;
+    std::vector<polyglot::BookEntry> entries;
+    internal::collectBookEntries(BoardState::fromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"), 4, states, entries);
+    const std::string bookPath = (path.empty() ? (std::filesystem::temp_directory_path() / "kitty_bench.bin").string() : path);
+    if (path.empty()) {
+      polyglot::writeBook(bookPath, entries);
+    }
+    std::mt19937_64 rng(0x4b69747479);
+    std::shuffle(states.begin(), states.end(), rng);
+
+    std::unique_ptr<polyglot::Book> book = polyglot::Book::open(bookPath);
+    if (!book) {
+      cout << format("can not open book {}\n", bookPath);
+      return;
+    }
+    cout << format("{} entries\n", book->size());
+
+    // Each sample maps the evicted file again, so the binary search faults every page it touches in from the disk.
+    constexpr uint32_t kColdSamples = 200;
+    uint64_t hits = 0;
+    double coldTotal = 0;
+    double coldMax = 0;
+    for (uint32_t i = 0; i < kColdSamples; ++i) {
+      book.reset();
+      if (!internal::evictFromPageCache(bookPath)) {
+        cout << "can not evict the book from the page cache on this platform\n";
+        break;
+      }
+      book = polyglot::Book::open(bookPath);
+      const auto start = high_resolution_clock::now();
+      hits += !book->probe(states[i % states.size()], rng()).isNull();
+      const double cold = static_cast<double>(duration_cast<nanoseconds>(high_resolution_clock::now() - start).count()) / 1000;
+      coldTotal += cold;
+      coldMax = std::max(coldMax, cold);
+      if (i + 1 == kColdSamples) {
+        cout << format("cold probe {:.1f} us, max {:.1f} us, over {} samples, {} hits\n", coldTotal / kColdSamples, coldMax, kColdSamples, hits);
+      }
+    }
+
+    if (path.empty()) {
+      book.reset();
+      std::filesystem::remove(bookPath);
+    }
+  }
+
+  // Generation time of the bitbases per thread count, doubling up to the given count.
+  // The probe latency is BM_BitbaseProbe in KittyEngineBenchmark.
+  inline void runBitbaseBenchmark(uint32_t maxThreadCount) {
+    using std::cout;
+    using std::format;
+    using namespace std::chrono;
+
+    std::vector<uint32_t> threadCounts;
+    for (uint32_t threadCount = 1; threadCount < maxThreadCount; threadCount *= 2) {
+      threadCounts.push_back(threadCount);
+    }
+    threadCounts.push_back(std::max(maxThreadCount, 1u));
+
+    bitbase::Tables tables;
+    for (uint32_t threadCount : threadCounts) {
+      std::array<bitbase::Report, bitbase::kMaterialSize> reports{};
+      const auto start = high_resolution_clock::now();
+      tables = bitbase::Tables::generate(threadCount, &reports);
+      const double time = static_cast<double>(duration_cast<microseconds>(high_resolution_clock::now() - start).count()) / 1000;
+      cout << format("threads {:2}, time {:7.1f} ms", threadCount, time);
+      for (uint32_t material = 0; material < bitbase::kMaterialSize; ++material) {
+        cout << format(", {} {:.1f} ms", bitbase::kMaterialNames[material], static_cast<double>(reports[material].time.count()) / 1000);
+      }
+      cout << "\n";
+      if (threadCount == threadCounts.back()) {
+        for (uint32_t material = 0; material < bitbase::kMaterialSize; ++material) {
+          const bitbase::Report& report = reports[material];
+          cout << format("{} {} KB, wins {}, draws {}, invalid {}, passes {}\n", bitbase::kMaterialNames[material],
+                         tables.getWords(static_cast<bitbase::Material>(material)).size_bytes() / 1024, report.wins, report.draws, report.invalids, report.passes);
+        }
+      }
+    }
+  }
+}
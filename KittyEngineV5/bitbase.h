@@ -0,0 +1,406 @@
+#pragma once
+#include "board.h"
+#include "move_list.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////////
+//                 ENDGAME BITBASE
+///////////////////////////////////////////////////////
+// Win or draw tables for a king and one piece against a bare king, one bit per position, set where the side with
+// the piece wins. They are solved by retrograde analysis over the legal move generator and are small enough to
+// generate at startup or to embed as source, see Tables::writeSource.
+namespace bitbase {
+  // In generation order, a piece set only depends on the sets before it. A pawn promotes into the queen and rook sets.
+  enum Material : uint32_t {
+    kKqk,
+    kKrk,
+    kKpk,
+    kMaterialSize,
+  };
+
+  inline constexpr std::array<Piece, kMaterialSize> kStrongPieces = { kQueen, kRook, kPawn };
+  inline constexpr std::array<const char*, kMaterialSize> kMaterialNames = { "KQK", "KRK", "KPK" };
+
+  // From the side to move's point of view.
+  enum Result : uint32_t {
+    kNoResult,
+    kDrawResult,
+    kWinResult,
+    kLossResult,
+  };
+
+  struct Report {
+    uint64_t wins;
+    uint64_t draws;
+    uint64_t invalids;  // Indices of illegal positions, or of no position at all. Their bit is clear.
+    uint32_t passes;
+    std::chrono::microseconds time;
+  };
+
+  namespace internal {
+    // A position is indexed by the side to move, a lead square, the other square of the strong side and the weak king,
+    // with the strong side as white. The lead is the pawn, mirrored onto files A to D, or in the sets without pawns
+    // the strong king, mirrored and flipped into the A8 D8 D5 triangle. Every other square takes all 64 values.
+    inline constexpr uint32_t kPawnLeadSize = 24;
+    inline constexpr uint32_t kKingLeadSize = 10;
+    inline constexpr uint8_t kNoSlot = 0xFF;
+
+    struct LeadTable {
+      std::array<Square, kPawnLeadSize> squares;
+      std::array<uint8_t, kSquareSize> slots;
+    };
+
+    inline constexpr std::array<LeadTable, 2> kLeadTables = []() {
+      std::array<LeadTable, 2> tables{};
+      for (LeadTable& table : tables) {
+        table.slots.fill(kNoSlot);
+      }
+      uint8_t kingSize = 0;
+      uint8_t pawnSize = 0;
+      for (Square square = 0; square < kSquareSize; ++square) {
+        const Square rank = getSquareRank(square);
+        const Square file = getSquareFile(square);
+        if (file < 4 && rank <= file) {
+          tables[0].squares[kingSize] = square;
+          tables[0].slots[square] = kingSize++;
+        }
+        if (file < 4 && rank > 0 && rank < 7) {
+          tables[1].squares[pawnSize] = square;
+          tables[1].slots[square] = pawnSize++;
+        }
+      }
+      return tables;
+    }();
+
+    [[nodiscard]] inline constexpr bool hasPawn(Material material) {
+      return kStrongPieces[material] == kPawn;
+    }
+
+    [[nodiscard]] inline constexpr Square transposeSquare(Square square) {
+      return rankFileToSquare(getSquareFile(square), getSquareRank(square));
+    }
+
+    // The squares are from the strong side as white, the color is the side to move.
+    [[nodiscard]] inline constexpr size_t getIndex(Material material, Color color, Square strongKing, Square piece, Square weakKing) {
+      Square lead = (hasPawn(material) ? piece : strongKing);
+      const auto apply = [&](auto transform) {
+        strongKing = transform(strongKing);
+        piece = transform(piece);
+        weakKing = transform(weakKing);
+        lead = transform(lead);
+      };
+      if (getSquareFile(lead) > 3) {
+        apply([](Square square) { return square ^ 7; });
+      }
+      if (!hasPawn(material)) {
+        if (getSquareRank(lead) > 3) {
+          apply([](Square square) { return square ^ 56; });
+        }
+        if (getSquareRank(lead) > getSquareFile(lead)) {
+          apply(transposeSquare);
+        }
+      }
+      const Square other = (hasPawn(material) ? strongKing : piece);
+      const size_t leadSize = (hasPawn(material) ? kPawnLeadSize : kKingLeadSize);
+      const size_t slot = kLeadTables[hasPawn(material)].slots[lead];
+      return ((static_cast<size_t>(color) * leadSize + slot) * kSquareSize + other) * kSquareSize + weakKing;
+    }
+
+    // A state with one piece besides the kings, owned by the strong color.
+    [[nodiscard]] inline constexpr size_t getIndex(Material material, const BoardState& state, Color strong) {
+      const Square flip = (strong == kWhite ? 0 : 56);
+      return getIndex(material, state.getColor() ^ strong, peekPiece(state.bitboards_[strong][kKing]) ^ flip,
+                      peekPiece(state.bitboards_[strong][kStrongPieces[material]]) ^ flip,
+                      peekPiece(state.bitboards_[strong ^ 1][kKing]) ^ flip);
+    }
+  }
+
+  [[nodiscard]] inline constexpr size_t getIndexSize(Material material) {
+    return 2 * (internal::hasPawn(material) ? internal::kPawnLeadSize : internal::kKingLeadSize) * kSquareSize * kSquareSize;
+  }
+
+  class Tables {
+    std::array<std::vector<uint64_t>, kMaterialSize> words_;
+
+  public:
+    // Every probe returns kNoResult until the tables are generated or loaded.
+    Tables() = default;
+
+    // Solve every piece set, split between the threads. The reports are written if given.
+    static Tables generate(uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency()),
+                           std::array<Report, kMaterialSize>* reports = nullptr);
+
+    // Take the words of one piece set, as written by writeSource. Return false if the size does not match the set.
+    bool load(Material material, std::span<const uint64_t> words) {
+      if (words.size() != getIndexSize(material) / 64) {
+        return false;
+      }
+      words_[material].assign(words.begin(), words.end());
+      return true;
+    }
+
+    std::span<const uint64_t> getWords(Material material) const {
+      return words_[material];
+    }
+
+    [[nodiscard]] bool isWin(Material material, size_t index) const {
+      return words_[material][index / 64] >> (index % 64) & 1;
+    }
+
+    // Return kNoResult unless the state has the two kings and at most one other piece. The bare kings and a lone
+    // minor piece are always a draw. The state must be legal, the bits of illegal positions read as draws.
+    [[nodiscard]] Result probe(const BoardState& state) const {
+      const Bitboard whiteOccupancy = state.getOccupancy(kWhite);
+      const Bitboard blackOccupancy = state.getOccupancy(kBlack);
+      const uint32_t pieceCount = countPiece(whiteOccupancy | blackOccupancy);
+      if (pieceCount != 3) {
+        return (pieceCount == 2 ? kDrawResult : kNoResult);
+      }
+      const Color strong = (countPiece(whiteOccupancy) == 2 ? kWhite : kBlack);
+      for (uint32_t material = 0; material < kMaterialSize; ++material) {
+        if (state.bitboards_[strong][kStrongPieces[material]]) {
+          if (words_[material].empty()) {
+            return kNoResult;
+          }
+          if (!isWin(static_cast<Material>(material), internal::getIndex(static_cast<Material>(material), state, strong))) {
+            return kDrawResult;
+          }
+          return (state.getColor() == strong ? kWinResult : kLossResult);
+        }
+      }
+      return kDrawResult;
+    }
+
+    // Write a header that defines the words of every generated set as constexpr arrays, to load with load.
+    void writeSource(std::ostream& out) const {
+      out << "#pragma once\n#include <array>\n#include <cstdint>\n\n";
+      out << "// Generated by KittyEngineV5 bitbase. One bit per position, set where the side with the piece wins.\n";
+      out << "namespace bitbase::embedded {\n";
+      for (uint32_t material = 0; material < kMaterialSize; ++material) {
+        const std::string name = kMaterialNames[material];
+        out << std::format("  inline constexpr std::array<uint64_t, {}> k{}{}{}Words = {{\n", words_[material].size(),
+                           name[0], static_cast<char>(name[1] - 'A' + 'a'), static_cast<char>(name[2] - 'A' + 'a'));
+        for (size_t i = 0; i < words_[material].size(); ++i) {
+          out << (i % 6 == 0 ? "    " : " ") << std::format("0x{:016X}ull,", words_[material][i]) << (i % 6 == 5 ? "\n" : "");
+        }
+        out << (words_[material].size() % 6 == 0 ? "" : "\n") << "  };\n";
+      }
+      out << "}\n";
+    }
+  };
+
+  // Solves one piece set. Positions are cut into chunks of whole words, each solved by one task at a time.
+  // The first pass generates the moves of every position and keeps the children of the unresolved ones.
+  // Every later pass resolves what it can from the children and drops the resolved positions, until a pass
+  // resolves nothing. A position that is never resolved can not be forced to a win, so it is a draw.
+  class Generator {
+    enum Cell : uint8_t {
+      kUnknownCell,
+      kWinCell,
+      kDrawCell,
+      kInvalidCell,
+    };
+
+    // Children outside the set being solved, resolved when the moves are generated.
+    static constexpr uint32_t kWinChild = UINT32_MAX;
+    static constexpr uint32_t kDrawChild = UINT32_MAX - 1;
+    static constexpr size_t kChunkSize = 4096;
+
+    struct Chunk {
+      std::vector<uint32_t> pending;     // The unresolved positions.
+      std::vector<uint32_t> offsets;     // Where the children of each pending position start, one past the end last.
+      std::vector<uint32_t> children;
+      uint64_t resolved;
+    };
+
+    Material material_;
+    const Tables& tables_;
+    size_t size_;
+    std::unique_ptr<std::atomic<uint8_t>[]> cells_;
+    std::vector<Chunk> chunks_;
+
+    Cell getChildCell(uint32_t child) const {
+      return (child == kWinChild ? kWinCell : child == kDrawChild ? kDrawCell : static_cast<Cell>(cells_[child].load(std::memory_order_relaxed)));
+    }
+
+    // The strong side wins if it has a winning move, or if every move of the weak side loses.
+    Cell classify(bool isStrongToMove, std::span<const uint32_t> children) const {
+      bool isAllResolved = true;
+      for (uint32_t child : children) {
+        const Cell cell = getChildCell(child);
+        if (cell == (isStrongToMove ? kWinCell : kDrawCell)) {
+          return cell;
+        }
+        isAllResolved = isAllResolved && cell != kUnknownCell;
+      }
+      return (!isAllResolved ? kUnknownCell : isStrongToMove ? kDrawCell : kWinCell);
+    }
+
+    void expandChunk(size_t chunkId) {
+      Chunk& chunk = chunks_[chunkId];
+      const size_t leadSize = size_ / 2 / kSquareSize / kSquareSize;
+      const Piece strongPiece = kStrongPieces[material_];
+      chunk.offsets.push_back(0);
+
+      for (size_t index = chunkId * kChunkSize; index < std::min(size_, (chunkId + 1) * kChunkSize); ++index) {
+        const Color color = static_cast<Color>(index / (size_ / 2));
+        const Square lead = internal::kLeadTables[internal::hasPawn(material_)].squares[index / kSquareSize / kSquareSize % leadSize];
+        const Square other = index / kSquareSize % kSquareSize;
+        const Square weakKing = index % kSquareSize;
+        const Square strongKing = (internal::hasPawn(material_) ? other : lead);
+        const Square piece = (internal::hasPawn(material_) ? lead : other);
+        // The kings never give check in the move generator, so kings next to each other are ruled out here.
+        if (strongKing == piece || piece == weakKing || isSquareSet(getAttack<kKing>(strongKing) | toBitboard(strongKing), weakKing)) {
+          cells_[index].store(kInvalidCell, std::memory_order_relaxed);
+          continue;
+        }
+
+        BoardState state{};
+        state.mailbox_.fill(BoardState::kEmptyCell);
+        state.enpassant_ = NO_SQUARE;
+        state.color_ = color;
+        const auto place = [&state](Color pieceColor, Piece pieceType, Square square) {
+          state.bitboards_[pieceColor][pieceType] = setSquare(0, square);
+          state.mailbox_[square] = BoardState::toMailboxCell(pieceColor, pieceType);
+        };
+        place(kWhite, kKing, strongKing);
+        place(kWhite, strongPiece, piece);
+        place(kBlack, kKing, weakKing);
+        if (color == kWhite ? state.isInCheck<kBlack>() : state.isInCheck<kWhite>()) {
+          cells_[index].store(kInvalidCell, std::memory_order_relaxed);
+          continue;
+        }
+
+        // A capture leaves the bare kings. A promotion is looked up in the set of the new piece. Any other child
+        // only moves one of the three squares, so it is indexed without making the move.
+        const size_t childBegin = chunk.children.size();
+        for (PackedMove move : MoveList::fromState(state)) {
+          const Square srce = move.getSrce();
+          const Square dest = move.getDest();
+          if (dest == piece) {
+            chunk.children.push_back(kDrawChild);
+          } else if (move.isPromotion()) {
+            BoardState child = state;
+            child.makeMove(move);
+            chunk.children.push_back(tables_.probe(child) == kLossResult ? kWinChild : kDrawChild);
+          } else {
+            chunk.children.push_back(static_cast<uint32_t>(internal::getIndex(material_, color ^ 1, (srce == strongKing ? dest : strongKing),
+                                                                              (srce == piece ? dest : piece), (srce == weakKing ? dest : weakKing))));
+          }
+        }
+
+        const std::span<const uint32_t> children(chunk.children.begin() + childBegin, chunk.children.end());
+        Cell cell = classify(color == kWhite, children);
+        if (children.empty()) {
+          cell = (color == kBlack && state.isInCheck<kBlack>() ? kWinCell : kDrawCell);
+        }
+        cells_[index].store(cell, std::memory_order_relaxed);
+        if (cell == kUnknownCell) {
+          chunk.pending.push_back(static_cast<uint32_t>(index));
+          chunk.offsets.push_back(static_cast<uint32_t>(chunk.children.size()));
+        } else {
+          chunk.children.resize(childBegin);
+        }
+      }
+    }
+
+    // Resolve what the children allow and compact the rest in place.
+    void solveChunk(size_t chunkId) {
+      Chunk& chunk = chunks_[chunkId];
+      size_t kept = 0;
+      uint32_t childEnd = 0;
+      for (size_t i = 0; i < chunk.pending.size(); ++i) {
+        const uint32_t index = chunk.pending[i];
+        const std::span<const uint32_t> children(chunk.children.begin() + chunk.offsets[i], chunk.children.begin() + chunk.offsets[i + 1]);
+        const Cell cell = classify(index < size_ / 2, children);
+        if (cell != kUnknownCell) {
+          cells_[index].store(cell, std::memory_order_relaxed);
+          continue;
+        }
+        std::copy(children.begin(), children.end(), chunk.children.begin() + childEnd);
+        chunk.pending[kept] = index;
+        chunk.offsets[kept] = childEnd;
+        childEnd += static_cast<uint32_t>(children.size());
+        ++kept;
+      }
+      chunk.resolved = chunk.pending.size() - kept;
+      chunk.pending.resize(kept);
+      chunk.offsets.resize(kept + 1);
+      chunk.offsets[kept] = childEnd;
+      chunk.children.resize(childEnd);
+    }
+
+  public:
+    Generator(Material material, const Tables& tables)
+      : material_(material), tables_(tables), size_(getIndexSize(material)), cells_(new std::atomic<uint8_t>[size_]()),
+        chunks_((size_ + kChunkSize - 1) / kChunkSize) {
+    }
+
+    // Cells read by other tasks only ever go from unknown to resolved, so a stale read delays a position by one
+    // pass at worst. The passes converge to the same table whatever the order the chunks run in.
+    std::vector<uint64_t> solve(ThreadPool& pool, Report& report) {
+      using namespace std::chrono;
+      const auto start = steady_clock::now();
+      const auto runPass = [&](auto pass) {
+        for (size_t chunkId = 0; chunkId < chunks_.size(); ++chunkId) {
+          pool.submit([pass, chunkId](size_t) { pass(chunkId); });
+        }
+        pool.wait();
+      };
+
+      runPass([this](size_t chunkId) { expandChunk(chunkId); });
+      report.passes = 1;
+      for (uint64_t resolved = 1; resolved != 0; ++report.passes) {
+        runPass([this](size_t chunkId) { solveChunk(chunkId); });
+        resolved = 0;
+        for (const Chunk& chunk : chunks_) {
+          resolved += chunk.resolved;
+        }
+      }
+
+      std::vector<uint64_t> words(size_ / 64);
+      report.wins = report.draws = report.invalids = 0;
+      for (size_t index = 0; index < size_; ++index) {
+        const uint8_t cell = cells_[index].load(std::memory_order_relaxed);
+        words[index / 64] |= static_cast<uint64_t>(cell == kWinCell) << (index % 64);
+        report.wins += (cell == kWinCell);
+        report.invalids += (cell == kInvalidCell);
+      }
+      report.draws = size_ - report.wins - report.invalids;
+      report.time = duration_cast<microseconds>(steady_clock::now() - start);
+      return words;
+    }
+  };
+
+  inline Tables Tables::generate(uint32_t threadCount, std::array<Report, kMaterialSize>* reports) {
+    Tables tables;
+    std::array<Report, kMaterialSize> materialReports{};
+    ThreadPool pool(threadCount);
+    for (uint32_t material = 0; material < kMaterialSize; ++material) {
+      Generator generator(static_cast<Material>(material), tables);
+      tables.words_[material] = generator.solve(pool, materialReports[material]);
+    }
+    if (reports) {
+      *reports = materialReports;
+    }
+    return tables;
+  }
+
+  // Generated on first use with every hardware thread, in a few milliseconds.
+  inline const Tables& getTables() {
+    static const Tables tables = Tables::generate();
+    return tables;
+  }
+}
@@ -8,6 +8,15 @@
 #include <string>
 #include <utility>
 
+// Define KITTY_ENABLE_PEXT to look up slider attacks with PEXT instead of magic bitboards. It needs a BMI2 target,
+// and only pays off where PEXT is a single fast instruction: Intel since Haswell, and AMD since Zen 3.
+#ifdef KITTY_ENABLE_PEXT
+#if !defined(__BMI2__) && !(defined(_MSC_VER) && defined(__AVX2__))
+#error "KITTY_ENABLE_PEXT needs a target with BMI2"
+#endif
+#include <immintrin.h>
+#endif
+
 ///////////////////////////////////////////////////////
 //                 BITBOARD DEFINITION
 ///////////////////////////////////////////////////////
@@ -222,12 +231,13 @@ namespace internal {
     return table;
   }();
 
-  // A plain magic bitboard implementation.
-  // Avoid using PEXT on AMD due to slow implementation.
+  // A plain magic bitboard implementation, with an optional dense PEXT indexed table.
+  // The backend is fixed at build time, so the lookups on the hot path never branch on it.
   struct SliderAttackTable {
-    Bitboard magicNum;          // Magic bitboard hashing
-    Bitboard maxAttackNoEdge;   // Maximum attack pattern excludes the border
-    Bitboard* attackReachable;  // Reachable attack table range, indexed by magic shifting
+    Bitboard magicNum;              // Magic bitboard hashing
+    Bitboard maxAttackNoEdge;       // Maximum attack pattern excludes the border
+    Bitboard* attackReachable;      // Reachable attack table range, indexed by magic shifting
+    Bitboard* pextAttackReachable;  // Reachable attack table range, indexed by PEXT without unused slots
 
     template <Piece piece>
     constexpr size_t getKey(Bitboard occupancy) const {
@@ -239,6 +249,12 @@ namespace internal {
     constexpr Bitboard getAttack(Bitboard occupancy) const {
       return attackReachable[getKey<piece>(occupancy)];
     }
+
+#ifdef KITTY_ENABLE_PEXT
+    Bitboard getPextAttack(Bitboard occupancy) const {
+      return pextAttackReachable[_pext_u64(occupancy, maxAttackNoEdge)];
+    }
+#endif
   };
 
   // Generate attack ray bitboard at square, spans outward and stops at occupancy bits at each direction.
@@ -267,6 +283,8 @@ namespace internal {
 
   inline std::array<Bitboard, 64 * 512> bishopAttackReachableTable{};
   inline std::array<Bitboard, 64 * 4096> rookAttackReachableTable{};
+  inline std::array<Bitboard, 5248> bishopPextAttackReachableTable{};
+  inline std::array<Bitboard, 102400> rookPextAttackReachableTable{};
 
   inline const auto sliderAttackTables = []() {
     constexpr std::array<std::array<Bitboard, kSquareSize>, kColorSize> kMagicNumTable = { {
@@ -313,6 +331,7 @@ namespace internal {
     // Generate for both bishop and rook.
     for (Piece piece : {kBishop, kRook}) {
       size_t offset = 0;
+      size_t pextOffset = 0;
 
       for (Square i = 0; i < kSquareSize; ++i) {
         SliderAttackTable& magic = table[i][piece - kBishop];
@@ -327,13 +346,19 @@ namespace internal {
         // Assign the attack table range.
         magic.attackReachable = (piece == kBishop ? bishopAttackReachableTable.data() : rookAttackReachableTable.data()) + offset;
 
+        magic.pextAttackReachable = (piece == kBishop ? bishopPextAttackReachableTable.data() : rookPextAttackReachableTable.data()) + pextOffset;
+
         size_t permutations = (piece == kBishop ? (1ull << 9) : (1ull << 12));
         offset += permutations;
+        pextOffset += 1ull << countPiece(magic.maxAttackNoEdge);
 
         // Generate all occupancy combination for each attack pattern.
-        for (Bitboard occupancy = magic.maxAttackNoEdge; ; occupancy = (occupancy - 1) & magic.maxAttackNoEdge) {
+        // The n-th subset in this descending walk is exactly the one PEXT maps to index (subsets - 1 - n).
+        size_t pextKey = (1ull << countPiece(magic.maxAttackNoEdge)) - 1;
+        for (Bitboard occupancy = magic.maxAttackNoEdge; ; occupancy = (occupancy - 1) & magic.maxAttackNoEdge, --pextKey) {
           size_t key = (piece == kBishop ? magic.getKey<kBishop>(occupancy) : magic.getKey<kRook>(occupancy));
           magic.attackReachable[key] = internal::generateSliderAttackReachable(piece, i, occupancy);
+          magic.pextAttackReachable[pextKey] = magic.attackReachable[key];
           assert(key < permutations);
           if (occupancy == 0) {
             break;
@@ -342,6 +367,7 @@ namespace internal {
       }
 
       assert(offset == (piece == kBishop ? bishopAttackReachableTable.size() : rookAttackReachableTable.size()));
+      assert(pextOffset == (piece == kBishop ? bishopPextAttackReachableTable.size() : rookPextAttackReachableTable.size()));
     }
     return table;
   }();
@@ -366,6 +392,16 @@ inline constexpr Bitboard getAttack(Square square) {
 template <Piece piece>
 requires (piece == kBishop || piece == kRook || piece == kQueen)
 inline constexpr Bitboard getAttack(Square square, Bitboard occupancy) {
+#ifdef KITTY_ENABLE_PEXT
+  if constexpr (piece == kBishop) {
+    return internal::sliderAttackTables[square][0].getPextAttack(occupancy);
+  } else if constexpr (piece == kRook) {
+    return internal::sliderAttackTables[square][1].getPextAttack(occupancy);
+  } else if constexpr (piece == kQueen) {
+    return internal::sliderAttackTables[square][0].getPextAttack(occupancy) |
+           internal::sliderAttackTables[square][1].getPextAttack(occupancy);
+  }
+#else
   if constexpr (piece == kBishop) {
     return internal::sliderAttackTables[square][0].getAttack<kBishop>(occupancy);
   } else if constexpr (piece == kRook) {
@@ -374,6 +410,7 @@ inline constexpr Bitboard getAttack(Square square, Bitboard occupancy) {
     return internal::sliderAttackTables[square][0].getAttack<kBishop>(occupancy) |
            internal::sliderAttackTables[square][1].getAttack<kRook>(occupancy);
   }
+#endif
 }
 
 
@@ -444,7 +481,7 @@ inline char pieceToAsciiVisualOnly(Color color, Piece piece) {
   return table[color][piece];
 }
 
-inline char pieceToAscii(Color color, Piece piece) {
+inline constexpr char pieceToAscii(Color color, Piece piece) {
   constexpr std::array<std::array<char, kPieceSize>, kColorSize> table = { {
     {'P', 'N', 'B', 'R', 'Q', 'K'},
     {'p', 'n', 'b', 'r', 'q', 'k'},
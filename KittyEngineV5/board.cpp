@@ -1,73 +1,254 @@
 #include "board.h"
+#include <charconv>
 #include <format>
 #include <iostream>
-#include <sstream>
 
-BoardState BoardState::fromFEN(const std::string& fen) {
+namespace {
+  constexpr uint8_t kNoFenCell = 0xFF;
+
+  // The mailbox cell of each piece letter, kNoFenCell for any other byte.
+  constexpr std::array<uint8_t, 256> kFenCells = []() {
+    std::array<uint8_t, 256> table{};
+    table.fill(kNoFenCell);
+    for (Color color : {kWhite, kBlack}) {
+      for (Piece piece = kPawn; piece < kNoPiece; ++piece) {
+        table[static_cast<uint8_t>(pieceToAscii(color, piece))] = BoardState::toMailboxCell(color, piece);
+      }
+    }
+    return table;
+  }();
+
+  // The castle permission of each castle letter, 0 for any other byte.
+  constexpr std::array<Bitboard, 256> kFenCastles = []() {
+    std::array<Bitboard, 256> table{};
+    table['K'] = kKingCastlePermission[kWhite];
+    table['Q'] = kQueenCastlePermission[kWhite];
+    table['k'] = kKingCastlePermission[kBlack];
+    table['q'] = kQueenCastlePermission[kBlack];
+    return table;
+  }();
+
+  constexpr bool isFenSpace(char letter) {
+    return letter == ' ' || letter == '\t' || letter == '\r' || letter == '\n';
+  }
+
+  // Return the next whitespace separated field and move the cursor past it, or an empty field at the end.
+  // A plain loop, find_first_of calls memchr once per character.
+  std::string_view nextFenField(std::string_view fen, size_t& cursor) {
+    while (cursor < fen.size() && isFenSpace(fen[cursor])) {
+      ++cursor;
+    }
+    const size_t begin = cursor;
+    while (cursor < fen.size() && !isFenSpace(fen[cursor])) {
+      ++cursor;
+    }
+    return fen.substr(begin, cursor - begin);
+  }
+
+  bool parseFenCounter(std::string_view field, uint32_t& counter) {
+    const auto [end, error] = std::from_chars(field.data(), field.data() + field.size(), counter);
+    return error == std::errc{} && end == field.data() + field.size();
+  }
+}
+
+FenError BoardState::parseFEN(std::string_view fen, BoardState& state) {
   BoardState boardState{};
-  std::istringstream ss(fen);
-
-  // Parse positions.
-  std::string position; ss >> position;
-  auto letter = position.begin();
-  for (Square i = 0; i < kSquareSize; ++letter) {
-    if (isdigit(*letter)) {
-      // Skip empty square.
-      i += *letter - '0';
-    } else if (isalpha(*letter)) {
-      // Must be piece
-      auto [team, piece] = asciiToPiece(*letter);
-      boardState.bitboards_[team][piece] = setSquare(boardState.bitboards_[team][piece], i);
-      ++i;
-    } // else Ignore rank separator.
+  boardState.mailbox_.fill(kEmptyCell);
+  size_t cursor = 0;
+
+  // Parse positions, rank 8 first. The piece keys and scores are added as the pieces are placed.
+  Square rank = 0;
+  Square file = 0;
+  for (char letter : nextFenField(fen, cursor)) {
+    if ('1' <= letter && letter <= '8') {
+      file += letter - '0';
+      if (file > kSideSize) {
+        return kFenBadBoard;
+      }
+    } else if (letter == '/') {
+      if (file != kSideSize || ++rank == kSideSize) {
+        return kFenBadBoard;
+      }
+      file = 0;
+    } else {
+      const uint8_t cell = kFenCells[static_cast<uint8_t>(letter)];
+      if (cell == kNoFenCell || file == kSideSize || ((cell & 7) == kPawn && (rank == 0 || rank == kSideSize - 1))) {
+        return kFenBadBoard;
+      }
+      const Color color = cell >> 3;
+      const Piece piece = cell & 7;
+      const Square square = rankFileToSquare(rank, file++);
+      boardState.bitboards_[color][piece] = setSquare(boardState.bitboards_[color][piece], square);
+      boardState.mailbox_[square] = cell;
+      boardState.key_ ^= getPieceKey(color, piece, square);
+      boardState.psqt_ += getPsqtScore(color, piece, square);
+      boardState.phase_ += getPhaseWeight(piece);
+    }
+  }
+  if (rank != kSideSize - 1 || file != kSideSize) {
+    return kFenBadBoard;
+  }
+  if (countPiece(boardState.bitboards_[kWhite][kKing]) != 1 || countPiece(boardState.bitboards_[kBlack][kKing]) != 1) {
+    return kFenBadKings;
   }
 
   // Parse team.
-  std::string team; ss >> team;
-  if (team == "w") {
-    boardState.color_ = kWhite;
+  const std::string_view team = nextFenField(fen, cursor);
+  if (team != "w" && team != "b") {
+    return kFenBadColor;
+  }
+  boardState.color_ = (team == "w" ? kWhite : kBlack);
+
+  // Parse castle permission.
+  const std::string_view castlePermission = nextFenField(fen, cursor);
+  if (castlePermission.empty()) {
+    return kFenBadCastle;
+  }
+  if (castlePermission != "-") {
+    for (char letter : castlePermission) {
+      const Bitboard permission = kFenCastles[static_cast<uint8_t>(letter)];
+      if (!permission) {
+        return kFenBadCastle;
+      }
+      boardState.castlePermission_ |= permission;
+    }
+  }
+
+  // Parse enpassant square, behind the pawn the other side just pushed.
+  const std::string_view enpassantSquare = nextFenField(fen, cursor);
+  if (enpassantSquare == "-") {
+    boardState.enpassant_ = NO_SQUARE;
+  } else if (enpassantSquare.size() == 2 && 'a' <= enpassantSquare[0] && enpassantSquare[0] <= 'h' &&
+             enpassantSquare[1] == (boardState.color_ == kWhite ? '6' : '3')) {
+    boardState.enpassant_ = rankFileToSquare('8' - enpassantSquare[1], enpassantSquare[0] - 'a');
   } else {
-    boardState.color_ = kBlack;
+    return kFenBadEnpassant;
   }
 
-  // Parse castle permisison.
-  std::string castlePermission; ss >> castlePermission;
-  if (castlePermission.find("K") != std::string::npos) {
-    boardState.castlePermission_ |= kKingCastlePermission[kWhite];
+  // Parse half move and full move, both optional.
+  if (const std::string_view halfmove = nextFenField(fen, cursor); !halfmove.empty()) {
+    const std::string_view fullmove = nextFenField(fen, cursor);
+    if (!parseFenCounter(halfmove, boardState.halfmove_) ||
+        (!fullmove.empty() && !parseFenCounter(fullmove, boardState.fullmove_)) || !nextFenField(fen, cursor).empty()) {
+      return kFenBadCounter;
+    }
   }
-  if (castlePermission.find("Q") != std::string::npos) {
-    boardState.castlePermission_ |= kQueenCastlePermission[kWhite];
+
+  boardState.key_ ^= getCastleKey(boardState.castlePermission_) ^ getEnpassantKey(boardState.enpassant_) ^
+                     (boardState.color_ == kBlack ? getSideKey() : 0);
+  state = boardState;
+  return kFenOk;
+}
+
+BoardState BoardState::fromFEN(std::string_view fen) {
+  BoardState boardState{};
+  [[maybe_unused]] const FenError error = parseFEN(fen, boardState);
+  assert(error == kFenOk && "invalid fen");
+  return boardState;
+}
+
+size_t BoardState::toFEN(std::span<char> buffer) const {
+  if (buffer.size() < kMaxFenLength) {
+    return 0;
+  }
+
+  char* out = buffer.data();
+  for (Square rank = 0; rank < kSideSize; ++rank) {
+    char emptyCount = 0;
+    for (Square file = 0; file < kSideSize; ++file) {
+      const uint8_t cell = mailbox_[rankFileToSquare(rank, file)];
+      if (cell == kEmptyCell) {
+        ++emptyCount;
+        continue;
+      }
+      if (emptyCount) {
+        *out++ = static_cast<char>('0' + emptyCount);
+        emptyCount = 0;
+      }
+      *out++ = pieceToAscii(cell >> 3, cell & 7);
+    }
+    if (emptyCount) {
+      *out++ = static_cast<char>('0' + emptyCount);
+    }
+    *out++ = (rank + 1 < kSideSize ? '/' : ' ');
+  }
+
+  *out++ = (color_ == kWhite ? 'w' : 'b');
+  *out++ = ' ';
+  // A right needs both its king and rook squares, moving one of them only clears its own square.
+  char* const castleBegin = out;
+  for (char letter : {'K', 'Q', 'k', 'q'}) {
+    const Bitboard permission = kFenCastles[static_cast<uint8_t>(letter)];
+    if ((castlePermission_ & permission) == permission) {
+      *out++ = letter;
+    }
+  }
+  if (out == castleBegin) {
+    *out++ = '-';
   }
-  if (castlePermission.find("k") != std::string::npos) {
-    boardState.castlePermission_ |= kKingCastlePermission[kBlack];
+  *out++ = ' ';
+  if (enpassant_ == NO_SQUARE) {
+    *out++ = '-';
+  } else {
+    *out++ = 'a' + static_cast<char>(enpassant_ % kSideSize);
+    *out++ = '8' - static_cast<char>(enpassant_ / kSideSize);
   }
-  if (castlePermission.find("q") != std::string::npos) {
-    boardState.castlePermission_ |= kQueenCastlePermission[kBlack];
+
+  // A counter is at most 10 digits, kMaxFenLength leaves room for both.
+  *out++ = ' ';
+  out = std::to_chars(out, out + 10, halfmove_).ptr;
+  *out++ = ' ';
+  out = std::to_chars(out, out + 10, fullmove_).ptr;
+  return static_cast<size_t>(out - buffer.data());
+}
+
+PackedMove BoardState::parseMove(const std::string& moveString) const {
+  const auto isSquare = [](char file, char rank) { return 'a' <= file && file <= 'h' && '1' <= rank && rank <= '8'; };
+  if (moveString.size() < 4 || moveString.size() > 5 || !isSquare(moveString[0], moveString[1]) || !isSquare(moveString[2], moveString[3])) {
+    return kNullMove;
   }
 
-  // Parse enpassant square.
-  std::string enpassantSquare; ss >> enpassantSquare;
-  boardState.enpassant_ = (enpassantSquare == "-" ? NO_SQUARE : stringToSquare(enpassantSquare));
+  const Square srce = rankFileToSquare('8' - moveString[1], moveString[0] - 'a');
+  const Square dest = rankFileToSquare('8' - moveString[3], moveString[2] - 'a');
+  const Piece piece = getPieceAt(color_, srce);
+  if (piece == kNoPiece) {
+    return kNullMove;
+  }
 
-  // Parse half move and full move.
-  if (ss >> boardState.halfmove_) {
-    ss >> boardState.fullmove_;
+  if (moveString.size() == 5) {
+    switch (moveString[4]) {
+    case 'n': return PackedMove(srce, dest, PackedMove::kPromotion | (kKnight - kKnight));
+    case 'b': return PackedMove(srce, dest, PackedMove::kPromotion | (kBishop - kKnight));
+    case 'r': return PackedMove(srce, dest, PackedMove::kPromotion | (kRook - kKnight));
+    case 'q': return PackedMove(srce, dest, PackedMove::kPromotion | (kQueen - kKnight));
+    default: return kNullMove;
+    }
   }
-  return boardState;
+
+  if (piece == kPawn) {
+    if (dest == enpassant_) {
+      return PackedMove(srce, dest, PackedMove::kEnpassant);
+    }
+    if (srce - dest == 16 || dest - srce == 16) {
+      return PackedMove(srce, dest, PackedMove::kDoublePush);
+    }
+  } else if (piece == kKing && srce == (color_ == kWhite ? E1 : E8)) {
+    if (dest == (color_ == kWhite ? G1 : G8)) {
+      return PackedMove(srce, dest, PackedMove::kKingSideCastle);
+    }
+    if (dest == (color_ == kWhite ? C1 : C8)) {
+      return PackedMove(srce, dest, PackedMove::kQueenSideCastle);
+    }
+  }
+  return PackedMove(srce, dest, PackedMove::kQuiet);
 }
 
 std::ostream& operator<<(std::ostream& out, const BoardState& boardState) {
   using std::format;
 
   const auto findPieceAscii = [&](Square square) {
-    for (Color team : { kWhite, kBlack }) {
-      for (Piece piece : {kPawn, kKnight, kBishop, kRook, kQueen, kKing}) {
-        if (isSquareSet(boardState.bitboards_[team][piece], square)) {
-          return pieceToAsciiVisualOnly(team, piece);
-        }
-      }
-    }
-    return '.';
+    const uint8_t cell = boardState.mailbox_[square];
+    return (cell == BoardState::kEmptyCell ? '.' : pieceToAsciiVisualOnly(cell >> 3, cell & 7));
   };
 
   for (Square i = 0; i < kSideSize; ++i) {
@@ -1,6 +1,12 @@
 #pragma once
+#include "instrumentation.h"
 #include "move.h"
+#include "psqt.h"
+#include "zobrist.h"
+#include <algorithm>
 #include <array>
+#include <span>
+#include <string_view>
 
 ///////////////////////////////////////////////////////
 //                 CHESS BOARD STATUS
@@ -45,6 +51,45 @@
 ///////////////////////////////////////////////////////
 //                 CHESS BOARD STATE
 ///////////////////////////////////////////////////////
+// Which subset of the legal moves enumerateMoves generates.
+// Captures and quiets split the legal moves with no overlap. Evasions must only be used while in check.
+enum GenerationType : uint32_t {
+  kAllMoves,
+  kCaptureMoves,   // Captures, enpassant and queen promotions.
+  kQuietMoves,     // Non captures, castling and under promotions.
+  kEvasionMoves,   // All legal moves out of check, skips the non king moves in double check.
+};
+
+// The state makeMove can not derive back from the move alone.
+struct UndoRecord {
+  uint64_t key;
+  Bitboard castlePermission;
+  PhaseScore psqt;
+  Square enpassant;
+  uint32_t halfmove;
+  int32_t phase;
+  Piece captured;
+};
+
+// Piece values for static exchange evaluation, indexed by Piece. The king is never captured and kNoPiece gains nothing.
+inline constexpr std::array<int32_t, kPieceSize + 1> kSeeValues = { 100, 300, 300, 500, 900, 0, 0 };
+
+// A receiver that only needs the number of legal moves opts into bulk counting.
+// It receives acceptMoveCount(count) with the popcount of each destination bitboard instead of one acceptMove per move.
+template <typename Receiver>
+concept BulkCountReceiver = requires { requires Receiver::kIsBulkCount; };
+
+// Why parseFEN rejected a FEN, named after the first field found malformed or missing.
+enum FenError : uint32_t {
+  kFenOk,
+  kFenBadBoard,      // Not 8 ranks of 8 files, an unknown piece, or a pawn on the first or last rank.
+  kFenBadKings,      // Not exactly one king of each color.
+  kFenBadColor,
+  kFenBadCastle,
+  kFenBadEnpassant,  // Not "-" or a square on the rank behind a pawn that just double pushed.
+  kFenBadCounter,    // The halfmove and fullmove counters are optional, anything else after them is an error.
+};
+
 class BoardState {
 public:
   std::array<std::array<Bitboard, kPieceSize>, kColorSize> bitboards_;
@@ -53,10 +98,15 @@ public:
   uint32_t halfmove_;
   uint32_t fullmove_;
   Color color_;
+  uint64_t key_;
+  PhaseScore psqt_;  // Material and piece square score from white's point of view.
+  int32_t phase_;
+  std::array<uint8_t, kSquareSize> mailbox_;  // Piece on each square, see toMailboxCell.
 
   // Return a bitboard containing squares attacked by their pieces.
   template <Color our>
   constexpr Bitboard getAttackedMask(Bitboard bothOccupancy) const {
+    KITTY_INSTRUMENT_PHASE(instrumentation::kAttackedMaskPhase);
     constexpr Color their = getOtherColor(our);
 
     // If king blocks the attack ray, then it may incorrectly move backward illegally.
@@ -85,10 +135,21 @@ public:
     return attackedMask;
   }
 
+  // Return a bitboard containing their pieces that attack our king.
+  template <Color our>
+  constexpr Bitboard getCheckers(Square kingSq, Bitboard bothOccupancy) const {
+    constexpr Color their = getOtherColor(our);
+    return (getAttack<kPawn, our>(kingSq) & bitboards_[their][kPawn]) |
+           (getAttack<kKnight>(kingSq) & bitboards_[their][kKnight]) |
+           (getAttack<kBishop>(kingSq, bothOccupancy) & (bitboards_[their][kBishop] | bitboards_[their][kQueen])) |
+           (getAttack<kRook>(kingSq, bothOccupancy) & (bitboards_[their][kRook] | bitboards_[their][kQueen]));
+  }
+
   // Return a bitboard containing the intersection of all attacks.
   // Must block the attack or capture the attackers.
   template <Color our>
   constexpr Bitboard getCheckedMask(Square kingSq, Bitboard bothOccupancy) const {
+    KITTY_INSTRUMENT_PHASE(instrumentation::kCheckedMaskPhase);
     constexpr Color their = getOtherColor(our);
 
     Bitboard checkedMask = ~Bitboard{};
@@ -107,6 +168,7 @@ public:
   // Return a bitboard containing our pieces that are pinned.
   template <Color our>
   constexpr Bitboard getPinnedMask(Square kingSq , const std::array<Bitboard, kColorSize> occupancy) const {
+    KITTY_INSTRUMENT_PHASE(instrumentation::kPinnedMaskPhase);
     constexpr Color their = getOtherColor(our);
 
     // Get the enemy sliders squares, then check if any ally piece is blocking the attack ray.
@@ -123,9 +185,55 @@ public:
     return pinnedMask;
   }
 
+  struct PackedMoveMaker {
+    BoardState& state;
+
+    template <MoveType moveType>
+    constexpr void acceptMove(const BoardState&, Move<moveType> move) {
+      state.makeMove(move);
+    }
+  };
+
+  struct PackedMoveUndoMaker {
+    BoardState& state;
+    UndoRecord& undo;
+
+    template <MoveType moveType>
+    constexpr void acceptMove(const BoardState&, Move<moveType> move) {
+      state.makeMove(move, undo);
+    }
+  };
+
+  struct PackedMoveUnmaker {
+    BoardState& state;
+    const UndoRecord& undo;
+
+    template <MoveType moveType>
+    constexpr void acceptMove(const BoardState&, Move<moveType> move) {
+      state.unmakeMove(move, undo);
+    }
+  };
+
+  template <MoveType moveType, typename Receiver>
+  constexpr void emitMove(Receiver& receiver, Square srce, Square dest) const {
+    KITTY_INSTRUMENT_MOVES(moveType.movedPiece, 1);
+    replayMove<moveType>(receiver, srce, dest);
+  }
+
+  // Same as emitMove, for moves that were already counted when they were generated.
+  template <MoveType moveType, typename Receiver>
+  constexpr void replayMove(Receiver& receiver, Square srce, Square dest) const {
+    if constexpr (BulkCountReceiver<Receiver>) {
+      receiver.acceptMoveCount(1);
+    } else {
+      receiver.acceptMove(*this, Move<moveType>(srce, dest));
+    }
+  }
+
   template <Color our, Piece piece, typename Receiver>
-  constexpr void getPieceMove(const Square kingSq, const std::array<Bitboard, kColorSize> occupancy,
-                                   const Bitboard checkedMask, const Bitboard pinnedMask) const {
+  constexpr void getPieceMove(Receiver& receiver, const Square kingSq, const std::array<Bitboard, kColorSize> occupancy,
+                              const Bitboard checkedMask, const Bitboard pinnedMask) const {
+    KITTY_INSTRUMENT_PHASE(instrumentation::getPieceMovePhase(piece));
     const Bitboard bothOccupancy = occupancy[kWhite] | occupancy[kBlack];
 
     Bitboard sbb = bitboards_[our][piece];
@@ -153,9 +261,63 @@ public:
         dbb &= getAttack<piece>(srce, bothOccupancy);
       }
 
-      for (; dbb; dbb = popPiece(dbb)) {
-        Square dest = peekPiece(dbb);
-        Receiver::acceptMove(*this, Move<MoveType{our, piece, 0, false, false, false, false}> (srce, dest));
+      KITTY_INSTRUMENT_MOVES(piece, countPiece(dbb));
+      if constexpr (BulkCountReceiver<Receiver>) {
+        receiver.acceptMoveCount(countPiece(dbb));
+      } else {
+        for (; dbb; dbb = popPiece(dbb)) {
+          Square dest = peekPiece(dbb);
+          receiver.acceptMove(*this, Move<MoveType{our, piece, 0, false, false, false, false}> (srce, dest));
+        }
+      }
+    }
+  }
+
+  // Generate the pawn moves landing on dbb. Each source pawn sits at dest + srceOffset.
+  // Capture generation keeps the queen promotions, quiet generation keeps the under promotions.
+  template <Color our, int32_t srceOffset, bool isDoublePush, GenerationType genType, typename Receiver>
+  constexpr void getPawnMove(Receiver& receiver, Bitboard dbb, const Square kingSq, const Bitboard pinnedMask) const {
+    constexpr Bitboard promotionMask = (our == kWhite ? kRank8Mask : kRank1Mask);
+    constexpr bool isQueenPromotion = genType != kQuietMoves;
+    constexpr bool isUnderPromotion = genType != kCaptureMoves;
+    constexpr uint32_t promotionCount = (isQueenPromotion ? 1 : 0) + (isUnderPromotion ? 3 : 0);
+
+    if constexpr (BulkCountReceiver<Receiver>) {
+      // Pawns that are not pinned can be counted at once, only the pinned ones need the line of sight check.
+      Bitboard pinnedDbb;
+      if constexpr (srceOffset > 0) {
+        pinnedDbb = dbb & (pinnedMask >> srceOffset);
+      } else {
+        pinnedDbb = dbb & (pinnedMask << -srceOffset);
+      }
+      const Bitboard freeDbb = dbb & ~pinnedDbb;
+      KITTY_INSTRUMENT_MOVES(kPawn, (isDoublePush ? countPiece(freeDbb) : countPiece(freeDbb & ~promotionMask) + countPiece(freeDbb & promotionMask) * promotionCount));
+      if constexpr (isDoublePush) {
+        receiver.acceptMoveCount(countPiece(freeDbb));
+      } else {
+        receiver.acceptMoveCount(countPiece(freeDbb & ~promotionMask) + countPiece(freeDbb & promotionMask) * promotionCount);
+      }
+      dbb = pinnedDbb;
+    }
+
+    for (; dbb; dbb = popPiece(dbb)) {
+      const Square dest = peekPiece(dbb);
+      const Square srce = dest + srceOffset;
+      if (!isSquareSet(pinnedMask, srce) || kLineOfSightMasks[kingSq][srce] == kLineOfSightMasks[kingSq][dest]) {
+        if constexpr (isDoublePush) {
+          emitMove<MoveType{our, kPawn, 0, false, true, false, false}>(receiver, srce, dest);
+        } else if (isSquareSet(promotionMask, dest)) {
+          if constexpr (isUnderPromotion) {
+            emitMove<MoveType{our, kPawn, kKnight, false, false, false, false}>(receiver, srce, dest);
+            emitMove<MoveType{our, kPawn, kBishop, false, false, false, false}>(receiver, srce, dest);
+            emitMove<MoveType{our, kPawn, kRook, false, false, false, false}>(receiver, srce, dest);
+          }
+          if constexpr (isQueenPromotion) {
+            emitMove<MoveType{our, kPawn, kQueen, false, false, false, false}>(receiver, srce, dest);
+          }
+        } else {
+          emitMove<MoveType{our, kPawn, 0, false, false, false, false}>(receiver, srce, dest);
+        }
       }
     }
   }
@@ -165,8 +327,27 @@ public:
     return color_;
   }
 
-  template <Color our, typename Receiver>
-  constexpr void enumerateMoves() const {
+  constexpr Bitboard getOccupancy(Color color) const {
+    return bitboards_[color][kPawn] | bitboards_[color][kKnight] | bitboards_[color][kBishop] |
+           bitboards_[color][kRook] | bitboards_[color][kQueen] | bitboards_[color][kKing];
+  }
+
+  // Compute the zobrist key from scratch. The make move code keeps key_ updated incrementally.
+  constexpr uint64_t computeKey() const {
+    uint64_t key = getCastleKey(castlePermission_) ^ getEnpassantKey(enpassant_) ^ (color_ == kBlack ? getSideKey() : 0);
+    for (Color color : {kWhite, kBlack}) {
+      for (Piece piece = kPawn; piece < kNoPiece; ++piece) {
+        for (Bitboard bb = bitboards_[color][piece]; bb; bb = popPiece(bb)) {
+          key ^= getPieceKey(color, piece, peekPiece(bb));
+        }
+      }
+    }
+    return key;
+  }
+
+  template <Color our, GenerationType genType = kAllMoves, typename Receiver>
+  constexpr void enumerateMoves(Receiver& receiver) const {
+    KITTY_INSTRUMENT_PHASE(instrumentation::kGeneratePhase);
     constexpr Color their = getOtherColor(our);
     const Square kingSq = peekPiece(bitboards_[our][kKing]);
     const std::array<Bitboard, kColorSize> occupancy = {
@@ -175,141 +356,701 @@ public:
     };
     const Bitboard bothOccupancy = occupancy[kWhite] | occupancy[kBlack];
     const Bitboard checkedMask = getCheckedMask<our>(kingSq, bothOccupancy);
-    const Bitboard pinnedMask = getPinnedMask<our>(kingSq, occupancy);
-
-    // Knight, Bishop, Rook, Queen Moves
-    getPieceMove<our, kKnight, Receiver>(kingSq, occupancy, checkedMask, pinnedMask);
-    getPieceMove<our, kBishop, Receiver>(kingSq, occupancy, checkedMask, pinnedMask);
-    getPieceMove<our, kRook, Receiver>(kingSq, occupancy, checkedMask, pinnedMask);
-    getPieceMove<our, kQueen, Receiver>(kingSq, occupancy, checkedMask, pinnedMask);
-    
-    // Pawn Moves
-    {
-      // Left Attack
-      for (Bitboard dbb = (our == kWhite ? shiftUpLeft(bitboards_[our][kPawn]) : shiftDownLeft(bitboards_[our][kPawn])) & occupancy[their] & checkedMask;
-           dbb;
-           dbb = popPiece(dbb)) {
-
-        const Square dest = peekPiece(dbb);
-        const Square srce = (our == kWhite ? squareDownRight(dest) : squareUpRight(dest));
-        if (!isSquareSet(pinnedMask, srce) || kLineOfSightMasks[kingSq][srce] == kLineOfSightMasks[kingSq][dest]) {
-          if (getSquareRank(dest) == kPromotionRank[our]) {
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, kKnight, false, false, false, false}>(srce, dest));
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, kBishop, false, false, false, false}>(srce, dest));
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, kRook, false, false, false, false}>(srce, dest));
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, kQueen, false, false, false, false}>(srce, dest));
-          } else {
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, 0, false, false, false, false}>(srce, dest));
+    KITTY_INSTRUMENT_NODE(instrumentation::kNodeCounter, true);
+    KITTY_INSTRUMENT_NODE(instrumentation::kCheckNodeCounter, checkedMask != ~Bitboard{});
+    KITTY_INSTRUMENT_NODE(instrumentation::kDoubleCheckNodeCounter, checkedMask == 0);
+
+    // Squares the generation type lets a piece land on.
+    constexpr Bitboard promotionMask = (our == kWhite ? kRank8Mask : kRank1Mask);
+    const Bitboard targetMask = (genType == kCaptureMoves ? occupancy[their] : genType == kQuietMoves ? ~bothOccupancy : ~Bitboard{});
+
+    // In double check, the checked mask is empty and only the king can move.
+    if (genType != kEvasionMoves || checkedMask) {
+      const Bitboard pinnedMask = getPinnedMask<our>(kingSq, occupancy);
+      KITTY_INSTRUMENT_NODE(instrumentation::kPinNodeCounter, pinnedMask != 0);
+
+      // Knight, Bishop, Rook, Queen Moves
+      getPieceMove<our, kKnight>(receiver, kingSq, occupancy, checkedMask & targetMask, pinnedMask);
+      getPieceMove<our, kBishop>(receiver, kingSq, occupancy, checkedMask & targetMask, pinnedMask);
+      getPieceMove<our, kRook>(receiver, kingSq, occupancy, checkedMask & targetMask, pinnedMask);
+      getPieceMove<our, kQueen>(receiver, kingSq, occupancy, checkedMask & targetMask, pinnedMask);
+
+      // Pawn Moves
+      {
+        KITTY_INSTRUMENT_PHASE(instrumentation::kPawnMovePhase);
+        // Quiet generation only keeps the capturing under promotions, which the capture generation leaves out.
+        const Bitboard attackMask = occupancy[their] & checkedMask & (genType == kQuietMoves ? promotionMask : ~Bitboard{});
+
+        // Left Attack
+        getPawnMove<our, (our == kWhite ? 9 : -7), false, genType>(
+          receiver, (our == kWhite ? shiftUpLeft(bitboards_[our][kPawn]) : shiftDownLeft(bitboards_[our][kPawn])) & attackMask,
+          kingSq, pinnedMask);
+
+        // Right Attack
+        getPawnMove<our, (our == kWhite ? 7 : -9), false, genType>(
+          receiver, (our == kWhite ? shiftUpRight(bitboards_[our][kPawn]) : shiftDownRight(bitboards_[our][kPawn])) & attackMask,
+          kingSq, pinnedMask);
+
+        // Push Forward
+        // Capture generation only keeps the queen promotions.
+        const Bitboard singlePushBB = (our == kWhite ? shiftUp(bitboards_[our][kPawn]) : shiftDown(bitboards_[our][kPawn])) & ~bothOccupancy;
+        getPawnMove<our, (our == kWhite ? 8 : -8), false, genType>(
+          receiver, singlePushBB & checkedMask & (genType == kCaptureMoves ? promotionMask : ~Bitboard{}), kingSq, pinnedMask);
+
+        // Push Twice
+        if constexpr (genType != kCaptureMoves) {
+          const Bitboard doublePushBB = (our == kWhite ? (shiftUp(singlePushBB) & kRank4Mask) : (shiftDown(singlePushBB) & kRank5Mask)) & ~bothOccupancy;
+          getPawnMove<our, (our == kWhite ? 16 : -16), true, genType>(receiver, doublePushBB & checkedMask, kingSq, pinnedMask);
+        }
+
+        // Enpassant
+        if (genType != kQuietMoves && enpassant_ != NO_SQUARE) {
+          KITTY_INSTRUMENT_PHASE(instrumentation::kEnpassantPhase);
+
+          // Enpassant does 2 things at once. Eliminate the double-pushed pawn checker, and block the enpassant square.
+          Square capturedSq = (their == kWhite ? squareUp(enpassant_) : squareDown(enpassant_));
+          if (isSquareSet(checkedMask, enpassant_) || isSquareSet(checkedMask, capturedSq)) {
+            for (Bitboard sbb = getAttack<kPawn, their>(enpassant_) & bitboards_[our][kPawn];
+                 sbb;
+                 sbb = popPiece(sbb)) {
+              Square srce = peekPiece(sbb);
+              Bitboard pseudoOccupancy = unsetSquare(moveSquare(bothOccupancy, srce, enpassant_), capturedSq);
+              Bitboard discoverAttack = getAttack<kBishop>(kingSq, pseudoOccupancy) & (bitboards_[their][kBishop] | bitboards_[their][kQueen]) |
+                getAttack<kRook>(kingSq, pseudoOccupancy) & (bitboards_[their][kRook] | bitboards_[their][kQueen]);
+              if (!discoverAttack) {
+                emitMove<MoveType{our, kPawn, 0, true, false, false, false}>(receiver, srce, enpassant_);
+              }
+            }
           }
         }
       }
+    }
 
-      // Right Attack
-      for (Bitboard dbb = (our == kWhite ? shiftUpRight(bitboards_[our][kPawn]) : shiftDownRight(bitboards_[our][kPawn])) & occupancy[their] & checkedMask;
-           dbb;
-           dbb = popPiece(dbb)) {
-
-        const Square dest = peekPiece(dbb);
-        const Square srce = (our == kWhite ? squareDownLeft(dest) : squareUpLeft(dest));
-        if (!isSquareSet(pinnedMask, srce) || kLineOfSightMasks[kingSq][srce] == kLineOfSightMasks[kingSq][dest]) {
-          if (getSquareRank(dest) == kPromotionRank[our]) {
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, kKnight, false, false, false, false}>(srce, dest));
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, kBishop, false, false, false, false}>(srce, dest));
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, kRook, false, false, false, false}>(srce, dest));
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, kQueen, false, false, false, false}>(srce, dest));
-          } else {
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, 0, false, false, false, false}>(srce, dest));
-          }
+    // King Moves
+    const Bitboard attackedMask = getAttackedMask<our>(bothOccupancy);
+    KITTY_INSTRUMENT_PHASE(instrumentation::kKingMovePhase);
+
+    // King Walk
+    const Bitboard kingWalkBB = getAttack<kKing>(kingSq) & ~occupancy[our] & ~attackedMask & targetMask;
+    KITTY_INSTRUMENT_MOVES(kKing, countPiece(kingWalkBB));
+    if constexpr (BulkCountReceiver<Receiver>) {
+      receiver.acceptMoveCount(countPiece(kingWalkBB));
+    } else {
+      for (Bitboard bb = kingWalkBB; bb; bb = popPiece(bb)) {
+        Square dest = peekPiece(bb);
+        receiver.acceptMove(*this, Move<MoveType{our, kKing, 0, false, false, false, false}>(kingSq, dest));
+      }
+    }
+
+    // Castling is quiet, and never legal in check.
+    if constexpr (genType == kAllMoves || genType == kQuietMoves) {
+      // King Castling
+      if ((castlePermission_ & kKingCastlePermission[our]) == kKingCastlePermission[our] &&  // Check castle permission
+          (bothOccupancy & kKingCastleOccupancy[our]) == 0 &&                                // Check castle blocker
+          (attackedMask & kKingCastleSafety[our]) == 0) {                                    // Check castle attacked squares
+        if constexpr (our == kWhite) {
+          emitMove<MoveType{our, kKing, 0, false, false, true, false}>(receiver, E1, G1);
+        } else {
+          emitMove<MoveType{our, kKing, 0, false, false, true, false}>(receiver, E8, G8);
         }
       }
 
-      // Push Forward
-      const Bitboard singlePushBB = (our == kWhite ? shiftUp(bitboards_[our][kPawn]) : shiftDown(bitboards_[our][kPawn])) & ~bothOccupancy;
-      for (Bitboard dbb = singlePushBB & checkedMask;
-           dbb;
-           dbb = popPiece(dbb)) {
-        const Square dest = peekPiece(dbb);
-        const Square srce = (our == kWhite ? squareDown(dest) : squareUp(dest));
-        if (!isSquareSet(pinnedMask, srce) || kLineOfSightMasks[kingSq][srce] == kLineOfSightMasks[kingSq][dest]) {
-          if (getSquareRank(dest) == kPromotionRank[our]) {
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, kKnight, false, false, false, false}>(srce, dest));
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, kBishop, false, false, false, false}>(srce, dest));
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, kRook, false, false, false, false}>(srce, dest));
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, kQueen, false, false, false, false}>(srce, dest));
-          } else {
-            Receiver::acceptMove(*this, Move<MoveType{our, kPawn, 0, false, false, false, false}>(srce, dest));
-          }
+      // Queen Castling
+      if ((castlePermission_ & kQueenCastlePermission[our]) == kQueenCastlePermission[our] && // Check castle permission
+          (bothOccupancy & kQueenCastleOccupancy[our]) == 0 &&                                // Check castle blocker
+          (attackedMask & kQueenCastleSafety[our]) == 0) {                                    // Check castle attacked squares
+        if constexpr (our == kWhite) {
+          emitMove<MoveType{our, kKing, 0, false, false, false, true}>(receiver, E1, C1);
+        } else {
+          emitMove<MoveType{our, kKing, 0, false, false, false, true}>(receiver, E8, C8);
         }
       }
+    }
+  }
+
+  // Return true if the side to move is in check.
+  template <Color our>
+  constexpr bool isInCheck() const {
+    const Square kingSq = peekPiece(bitboards_[our][kKing]);
+    return getCheckers<our>(kingSq, getOccupancy(kWhite) | getOccupancy(kBlack)) != 0;
+  }
+
+  // Return the pieces of both colors that attack the square through the occupancy.
+  constexpr Bitboard getAttackers(Square square, Bitboard occupancy) const {
+    return (getAttack<kPawn, kBlack>(square) & bitboards_[kWhite][kPawn]) |
+           (getAttack<kPawn, kWhite>(square) & bitboards_[kBlack][kPawn]) |
+           (getAttack<kKnight>(square) & (bitboards_[kWhite][kKnight] | bitboards_[kBlack][kKnight])) |
+           (getAttack<kKing>(square) & (bitboards_[kWhite][kKing] | bitboards_[kBlack][kKing])) |
+           (getAttack<kBishop>(square, occupancy) & (bitboards_[kWhite][kBishop] | bitboards_[kBlack][kBishop] | bitboards_[kWhite][kQueen] | bitboards_[kBlack][kQueen])) |
+           (getAttack<kRook>(square, occupancy) & (bitboards_[kWhite][kRook] | bitboards_[kBlack][kRook] | bitboards_[kWhite][kQueen] | bitboards_[kBlack][kQueen]));
+  }
+
+  // Return our pieces that may join an exchange on the square. A pinned piece may only capture along its pin line.
+  // The pins are taken before the exchange starts, and stay even if the pinner is traded off.
+  template <Color our>
+  constexpr Bitboard getExchangers(Square square, const std::array<Bitboard, kColorSize> occupancy) const {
+    const Square kingSq = peekPiece(bitboards_[our][kKing]);
+    Bitboard exchangers = occupancy[our];
+    for (Bitboard pinned = getPinnedMask<our>(kingSq, occupancy); pinned; pinned = popPiece(pinned)) {
+      const Square sq = peekPiece(pinned);
+      if (!isSquareSet(kLineOfSightMasks[kingSq][sq], square)) {
+        exchangers = unsetSquare(exchangers, sq);
+      }
+    }
+    return exchangers;
+  }
 
-      // Push Twice
-      const Bitboard doublePushBB = (our == kWhite ? (shiftUp(singlePushBB) & kRank4Mask) : (shiftDown(singlePushBB) & kRank5Mask)) & ~bothOccupancy;
-      for (Bitboard dbb = doublePushBB & checkedMask;
-           dbb;
-           dbb = popPiece(dbb)) {
-        const Square dest = peekPiece(dbb);
-        const Square srce = (our == kWhite ? squareDown(squareDown(dest)) : squareUp(squareUp(dest)));
-        if (!isSquareSet(pinnedMask, srce) || kLineOfSightMasks[kingSq][srce] == kLineOfSightMasks[kingSq][dest]) {
-          Receiver::acceptMove(*this, Move<MoveType{our, kPawn, 0, false, true, false, false}>(srce, dest));
+  // Take the least valuable attacker of that color off the occupancy, and reveal the sliders behind it.
+  // Return the piece, or kNoPiece if the color has no attacker left.
+  constexpr Piece popLeastValuableAttacker(Color color, Square square, Bitboard exchangers, Bitboard& occupancy, Bitboard& attackers) const {
+    for (Piece piece = kPawn; piece < kNoPiece; ++piece) {
+      const Bitboard bb = attackers & exchangers & bitboards_[color][piece];
+      if (bb) {
+        occupancy = unsetSquare(occupancy, peekPiece(bb));
+        if (piece == kPawn || piece == kBishop || piece == kQueen) {
+          attackers |= getAttack<kBishop>(square, occupancy) & (bitboards_[kWhite][kBishop] | bitboards_[kBlack][kBishop] | bitboards_[kWhite][kQueen] | bitboards_[kBlack][kQueen]);
+        }
+        if (piece == kRook || piece == kQueen) {
+          attackers |= getAttack<kRook>(square, occupancy) & (bitboards_[kWhite][kRook] | bitboards_[kBlack][kRook] | bitboards_[kWhite][kQueen] | bitboards_[kBlack][kQueen]);
         }
+        attackers &= occupancy;
+        return piece;
       }
+    }
+    return kNoPiece;
+  }
 
-      // Enpassant
-      if (enpassant_ != NO_SQUARE) {
-
-        // Enpassant does 2 things at once. Eliminate the double-pushed pawn checker, and block the enpassant square.
-        Square capturedSq = (their == kWhite ? squareUp(enpassant_) : squareDown(enpassant_));
-        if (isSquareSet(checkedMask, enpassant_) || isSquareSet(checkedMask, capturedSq)) {
-          for (Bitboard sbb = getAttack<kPawn, their>(enpassant_) & bitboards_[our][kPawn];
-               sbb;
-               sbb = popPiece(sbb)) {
-            Square srce = peekPiece(sbb);
-            Bitboard pseudoOccupancy = unsetSquare(moveSquare(bothOccupancy, srce, enpassant_), capturedSq);
-            Bitboard discoverAttack = getAttack<kBishop>(kingSq, pseudoOccupancy) & (bitboards_[their][kBishop] | bitboards_[their][kQueen]) |
-              getAttack<kRook>(kingSq, pseudoOccupancy) & (bitboards_[their][kRook] | bitboards_[their][kQueen]);
-            if (!discoverAttack) {
-              Receiver::acceptMove(*this, Move<MoveType{our, kPawn, 0, true, false, false, false}>(srce, enpassant_));
-            }
-          }
+  // Return the material our move wins once the exchange on its destination square is played out,
+  // each side capturing with its least valuable piece and free to stop. Castling exchanges nothing.
+  template <Color our>
+  constexpr int32_t see(PackedMove move) const {
+    const uint16_t flag = move.getFlag();
+    if (flag == PackedMove::kKingSideCastle || flag == PackedMove::kQueenSideCastle) {
+      return 0;
+    }
+
+    const Square srce = move.getSrce();
+    const Square dest = move.getDest();
+    const std::array<Bitboard, kColorSize> occupancy = { getOccupancy(kWhite), getOccupancy(kBlack) };
+    Bitboard bothOccupancy = unsetSquare(occupancy[kWhite] | occupancy[kBlack], srce);
+    if (flag == PackedMove::kEnpassant) {
+      bothOccupancy = unsetSquare(bothOccupancy, our == kWhite ? squareDown(dest) : squareUp(dest));
+    }
+
+    const std::array<Bitboard, kColorSize> exchangers = { getExchangers<kWhite>(dest, occupancy), getExchangers<kBlack>(dest, occupancy) };
+    Bitboard attackers = getAttackers(dest, bothOccupancy) & bothOccupancy;
+
+    // gains[i] is the material won by the side making the i-th capture, if the exchange stopped right after it.
+    std::array<int32_t, 32> gains{};
+    Piece onSquare = (move.isPromotion() ? move.getPromotionPiece() : getPieceAt(srce));
+    gains[0] = kSeeValues[flag == PackedMove::kEnpassant ? kPawn : getPieceAt(dest)] + kSeeValues[onSquare] - kSeeValues[getPieceAt(srce)];
+
+    size_t depth = 0;
+    for (Color color = our; ;) {
+      color = (color == kWhite ? kBlack : kWhite);
+      const Piece piece = popLeastValuableAttacker(color, dest, exchangers[color], bothOccupancy, attackers);
+      if (piece == kNoPiece) {
+        break;
+      }
+      // The king may not capture onto a square the other side still attacks.
+      if (piece == kKing && (attackers & exchangers[color == kWhite ? kBlack : kWhite])) {
+        break;
+      }
+      ++depth;
+      gains[depth] = kSeeValues[onSquare] - gains[depth - 1];
+      onSquare = piece;
+    }
+
+    // Each side stands pat instead of capturing if that loses material.
+    for (; depth > 0; --depth) {
+      gains[depth - 1] = -std::max(-gains[depth - 1], gains[depth]);
+    }
+    return gains[0];
+  }
+
+  // Return see(move) >= threshold, stopping as soon as the exchange is decided either way.
+  template <Color our>
+  constexpr bool seeGe(PackedMove move, int32_t threshold) const {
+    const uint16_t flag = move.getFlag();
+    if (flag == PackedMove::kKingSideCastle || flag == PackedMove::kQueenSideCastle) {
+      return 0 >= threshold;
+    }
+
+    const Square srce = move.getSrce();
+    const Square dest = move.getDest();
+    const Piece moved = (move.isPromotion() ? move.getPromotionPiece() : getPieceAt(srce));
+
+    // swap is what the side to capture next must win back so the exchange stays at or above the threshold.
+    int32_t swap = kSeeValues[flag == PackedMove::kEnpassant ? kPawn : getPieceAt(dest)] + kSeeValues[moved] - kSeeValues[getPieceAt(srce)] - threshold;
+    if (swap < 0) {
+      return false;
+    }
+    swap = kSeeValues[moved] - swap;
+    if (swap <= 0) {
+      return true;
+    }
+
+    const std::array<Bitboard, kColorSize> occupancy = { getOccupancy(kWhite), getOccupancy(kBlack) };
+    Bitboard bothOccupancy = unsetSquare(occupancy[kWhite] | occupancy[kBlack], srce);
+    if (flag == PackedMove::kEnpassant) {
+      bothOccupancy = unsetSquare(bothOccupancy, our == kWhite ? squareDown(dest) : squareUp(dest));
+    }
+
+    const std::array<Bitboard, kColorSize> exchangers = { getExchangers<kWhite>(dest, occupancy), getExchangers<kBlack>(dest, occupancy) };
+    Bitboard attackers = getAttackers(dest, bothOccupancy) & bothOccupancy;
+
+    // isAbove tells whether we stay at or above the threshold if the exchange stopped now.
+    bool isAbove = true;
+    for (Color color = our; ;) {
+      color = (color == kWhite ? kBlack : kWhite);
+      const Piece piece = popLeastValuableAttacker(color, dest, exchangers[color], bothOccupancy, attackers);
+      if (piece == kNoPiece) {
+        break;
+      }
+      isAbove = !isAbove;
+      if (piece == kKing) {
+        return (attackers & exchangers[color == kWhite ? kBlack : kWhite]) ? !isAbove : isAbove;
+      }
+      swap = kSeeValues[piece] - swap;
+      if (swap < static_cast<int32_t>(isAbove)) {
+        break;
+      }
+    }
+    return isAbove;
+  }
+
+  constexpr int32_t see(PackedMove move) const {
+    return color_ == kWhite ? see<kWhite>(move) : see<kBlack>(move);
+  }
+
+  constexpr bool seeGe(PackedMove move, int32_t threshold) const {
+    return color_ == kWhite ? seeGe<kWhite>(move, threshold) : seeGe<kBlack>(move, threshold);
+  }
+
+  // Return true if the capture generation emits the move: captures, enpassant and queen promotions.
+  // Capturing under promotions belong to the quiet generation.
+  constexpr bool isCaptureMove(PackedMove move) const {
+    if (move.isPromotion()) {
+      return move.getPromotionPiece() == kQueen;
+    }
+    return getPieceAt(move.getDest()) != kNoPiece || move.getFlag() == PackedMove::kEnpassant;
+  }
+
+  // Return true if enumerateMoves would emit the move, without generating the other moves.
+  // Checks a move from elsewhere, such as the hash move or a killer, before it is made in this position.
+  template <Color our>
+  constexpr bool isLegal(PackedMove move) const {
+    constexpr Color their = getOtherColor(our);
+    constexpr Bitboard promotionMask = (our == kWhite ? kRank8Mask : kRank1Mask);
+    constexpr Bitboard doublePushMask = (our == kWhite ? kRank2Mask : kRank7Mask);
+    const Square srce = move.getSrce();
+    const Square dest = move.getDest();
+    const Piece piece = getPieceAt(our, srce);
+    if (move.isNull() || piece == kNoPiece || getPieceAt(our, dest) != kNoPiece) {
+      return false;
+    }
+
+    const Bitboard bothOccupancy = getOccupancy(kWhite) | getOccupancy(kBlack);
+    const Square pushSq = (our == kWhite ? squareUp(srce) : squareDown(srce));
+    const bool isPush = dest == pushSq && !isSquareSet(bothOccupancy, dest);
+    const bool isPawnCapture = isSquareSet(getAttack<kPawn, our>(srce) & getOccupancy(their), dest);
+
+    switch (move.getFlag()) {
+    case PackedMove::kKingSideCastle:
+    case PackedMove::kQueenSideCastle: {
+      // The castle safety squares include the king square, so this also rules out castling out of check.
+      const bool isKingSide = move.getFlag() == PackedMove::kKingSideCastle;
+      const Bitboard permission = (isKingSide ? kKingCastlePermission[our] : kQueenCastlePermission[our]);
+      return piece == kKing && srce == (our == kWhite ? E1 : E8) &&
+             dest == (our == kWhite ? (isKingSide ? G1 : C1) : (isKingSide ? G8 : C8)) &&
+             (castlePermission_ & permission) == permission &&
+             (bothOccupancy & (isKingSide ? kKingCastleOccupancy[our] : kQueenCastleOccupancy[our])) == 0 &&
+             (getAttackedMask<our>(bothOccupancy) & (isKingSide ? kKingCastleSafety[our] : kQueenCastleSafety[our])) == 0;
+    }
+    case PackedMove::kDoublePush:
+      if (piece != kPawn || !isSquareSet(doublePushMask, srce) || isSquareSet(bothOccupancy, pushSq) ||
+          dest != (our == kWhite ? squareUp(pushSq) : squareDown(pushSq)) || isSquareSet(bothOccupancy, dest)) {
+        return false;
+      }
+      break;
+    case PackedMove::kEnpassant:
+      if (piece != kPawn || dest != enpassant_ || !isSquareSet(getAttack<kPawn, our>(srce), dest)) {
+        return false;
+      }
+      break;
+    case PackedMove::kPromotion | 0:
+    case PackedMove::kPromotion | 1:
+    case PackedMove::kPromotion | 2:
+    case PackedMove::kPromotion | 3:
+      if (piece != kPawn || !isSquareSet(promotionMask, dest) || !(isPush || isPawnCapture)) {
+        return false;
+      }
+      break;
+    case PackedMove::kQuiet:
+      if (piece == kPawn) {
+        if (isSquareSet(promotionMask, dest) || !(isPush || isPawnCapture)) {
+          return false;
+        }
+      } else if (piece == kKnight) {
+        if (!isSquareSet(getAttack<kKnight>(srce), dest)) {
+          return false;
+        }
+      } else if (piece == kBishop) {
+        if (!isSquareSet(getAttack<kBishop>(srce, bothOccupancy), dest)) {
+          return false;
+        }
+      } else if (piece == kRook) {
+        if (!isSquareSet(getAttack<kRook>(srce, bothOccupancy), dest)) {
+          return false;
+        }
+      } else if (piece == kQueen) {
+        if (!isSquareSet(getAttack<kQueen>(srce, bothOccupancy), dest)) {
+          return false;
         }
+      } else if (!isSquareSet(getAttack<kKing>(srce), dest)) {
+        return false;
       }
+      break;
+    default:
+      return false;
     }
 
-    // King Moves
-    const Bitboard attackedMask = getAttackedMask<our>(bothOccupancy);
+    // The move is possible, now it must not leave our king in check.
+    BoardState child = *this;
+    child.makeMove(move);
+    return !child.isInCheck<our>();
+  }
 
-    // King Walk
-    for (Bitboard bb = getAttack<kKing>(kingSq) & ~occupancy[our] & ~attackedMask;
-          bb;
-          bb = popPiece(bb)) {
-      Square dest = peekPiece(bb);
-      Receiver::acceptMove(*this, Move<MoveType{our, kKing, 0, false, false, false, false}>(kingSq, dest));
+  constexpr bool isLegal(PackedMove move) const {
+    return color_ == kWhite ? isLegal<kWhite>(move) : isLegal<kBlack>(move);
+  }
+
+  // Compute the piece square score and game phase from scratch. The make move code keeps psqt_ and phase_ updated incrementally.
+  constexpr PhaseScore computePsqt() const {
+    PhaseScore score{};
+    for (Color color : {kWhite, kBlack}) {
+      for (Piece piece = kPawn; piece < kNoPiece; ++piece) {
+        for (Bitboard bb = bitboards_[color][piece]; bb; bb = popPiece(bb)) {
+          score += getPsqtScore(color, piece, peekPiece(bb));
+        }
+      }
     }
+    return score;
+  }
 
-    // King Castling
-    if ((castlePermission_ & kKingCastlePermission[our]) == kKingCastlePermission[our] &&  // Check castle permission
-        (bothOccupancy & kKingCastleOccupancy[our]) == 0 &&                                // Check castle blocker
-        (attackedMask & kKingCastleSafety[our]) == 0) {                                        // Check castle attacked squares
-      if constexpr (our == kWhite) {
-        Receiver::acceptMove(*this, Move<MoveType{our, kKing, 0, false, false, true, false}>(E1, G1));
+  constexpr int32_t computePhase() const {
+    int32_t phase = 0;
+    for (Color color : {kWhite, kBlack}) {
+      for (Piece piece = kPawn; piece < kNoPiece; ++piece) {
+        phase += getPhaseWeight(piece) * static_cast<int32_t>(countPiece(bitboards_[color][piece]));
+      }
+    }
+    return phase;
+  }
+
+  // A mailbox cell packs the piece in the low 3 bits and the color above it. An empty square holds kEmptyCell.
+  static constexpr uint8_t kEmptyCell = kNoPiece;
+
+  static constexpr uint8_t toMailboxCell(Color color, Piece piece) {
+    return static_cast<uint8_t>(piece | color << 3);
+  }
+
+  // Return the piece of that color on the square, or kNoPiece.
+  constexpr Piece getPieceAt(Color color, Square square) const {
+    const uint8_t cell = mailbox_[square];
+    return ((cell >> 3) == color ? cell & 7 : kNoPiece);
+  }
+
+  // Return the piece of either color on the square, or kNoPiece.
+  constexpr Piece getPieceAt(Square square) const {
+    return mailbox_[square] & 7;
+  }
+
+  // Rebuild the mailbox from the bitboards. The make move code keeps mailbox_ updated incrementally.
+  constexpr std::array<uint8_t, kSquareSize> computeMailbox() const {
+    std::array<uint8_t, kSquareSize> mailbox{};
+    mailbox.fill(kEmptyCell);
+    for (Color color : {kWhite, kBlack}) {
+      for (Piece piece = kPawn; piece < kNoPiece; ++piece) {
+        for (Bitboard bb = bitboards_[color][piece]; bb; bb = popPiece(bb)) {
+          mailbox[peekPiece(bb)] = toMailboxCell(color, piece);
+        }
+      }
+    }
+    return mailbox;
+  }
+
+  // Apply the move in place. Copy-make callers copy the parent state first.
+  // Return the piece captured on the destination square, or kNoPiece. Enpassant is known from the move type.
+  template <MoveType moveType>
+  constexpr Piece makeMove(Move<moveType> move) {
+    KITTY_INSTRUMENT_PHASE(instrumentation::kMakeMovePhase);
+    constexpr Color our = moveType.color;
+    constexpr Color their = getOtherColor(our);
+    const Square srce = move.srce;
+    const Square dest = move.dest;
+
+    // Remove the captured piece, looked up in the mailbox before it is overwritten.
+    const Piece captured = getPieceAt(their, dest);
+    if (captured != kNoPiece) {
+      bitboards_[their][captured] = unsetSquare(bitboards_[their][captured], dest);
+      key_ ^= getPieceKey(their, captured, dest);
+      psqt_ -= getPsqtScore(their, captured, dest);
+      phase_ -= getPhaseWeight(captured);
+    }
+
+    // Move the square.
+    bitboards_[our][moveType.movedPiece] = moveSquare(bitboards_[our][moveType.movedPiece], srce, dest);
+    key_ ^= getPieceKey(our, moveType.movedPiece, srce) ^ getPieceKey(our, moveType.movedPiece, dest);
+    psqt_ += getPsqtScore(our, moveType.movedPiece, dest) - getPsqtScore(our, moveType.movedPiece, srce);
+    mailbox_[srce] = kEmptyCell;
+    mailbox_[dest] = toMailboxCell(our, moveType.movedPiece);
+
+    // Reset enpassant square
+    const Square enpassantSq = enpassant_;
+    key_ ^= getEnpassantKey(enpassantSq);
+    if constexpr (!moveType.isDoublePush) {
+      enpassant_ = NO_SQUARE;
+    }
+
+    // Update castle occupancy.
+    const Bitboard castlePermission = unsetSquare(unsetSquare(castlePermission_, srce), dest);
+    if (castlePermission != castlePermission_) {
+      key_ ^= getCastleKey(castlePermission ^ castlePermission_);
+      castlePermission_ = castlePermission;
+    }
+
+    // Update half move and full move.
+    ++halfmove_;
+    if (captured != kNoPiece) {
+      halfmove_ = 0;
+    }
+
+    if constexpr (our == kBlack) {
+      ++fullmove_;
+    }
+
+    if constexpr (moveType.movedPiece == kPawn) {
+      halfmove_ = 0;
+
+      if constexpr (moveType.isEnpassant) {
+        if constexpr (their == kWhite) {
+          bitboards_[their][kPawn] = unsetSquare(bitboards_[their][kPawn], squareUp(enpassantSq));
+          key_ ^= getPieceKey(their, kPawn, squareUp(enpassantSq));
+          psqt_ -= getPsqtScore(their, kPawn, squareUp(enpassantSq));
+          mailbox_[squareUp(enpassantSq)] = kEmptyCell;
+        } else {
+          bitboards_[their][kPawn] = unsetSquare(bitboards_[their][kPawn], squareDown(enpassantSq));
+          key_ ^= getPieceKey(their, kPawn, squareDown(enpassantSq));
+          psqt_ -= getPsqtScore(their, kPawn, squareDown(enpassantSq));
+          mailbox_[squareDown(enpassantSq)] = kEmptyCell;
+        }
+      } else if constexpr (moveType.isDoublePush) {
+        if constexpr (our == kWhite) {
+          enpassant_ = squareUp(srce);
+        } else {
+          enpassant_ = squareDown(srce);
+        }
+        key_ ^= getEnpassantKey(enpassant_);
+      } else if constexpr (moveType.promotionPiece) {
+        bitboards_[our][kPawn] = unsetSquare(bitboards_[our][kPawn], dest);
+        bitboards_[our][moveType.promotionPiece] = setSquare(bitboards_[our][moveType.promotionPiece], dest);
+        key_ ^= getPieceKey(our, kPawn, dest) ^ getPieceKey(our, moveType.promotionPiece, dest);
+        psqt_ += getPsqtScore(our, moveType.promotionPiece, dest) - getPsqtScore(our, kPawn, dest);
+        phase_ += getPhaseWeight(moveType.promotionPiece);
+        mailbox_[dest] = toMailboxCell(our, moveType.promotionPiece);
+      }
+
+    } else if constexpr (moveType.movedPiece == kKing) {
+      if constexpr (moveType.isKingSideCastle) {
+        if constexpr (our == kWhite) {
+          bitboards_[our][kRook] = moveSquare(bitboards_[our][kRook], H1, F1);
+          key_ ^= getPieceKey(our, kRook, H1) ^ getPieceKey(our, kRook, F1);
+          psqt_ += getPsqtScore(our, kRook, F1) - getPsqtScore(our, kRook, H1);
+          mailbox_[H1] = kEmptyCell;
+          mailbox_[F1] = toMailboxCell(our, kRook);
+        } else {
+          bitboards_[our][kRook] = moveSquare(bitboards_[our][kRook], H8, F8);
+          key_ ^= getPieceKey(our, kRook, H8) ^ getPieceKey(our, kRook, F8);
+          psqt_ += getPsqtScore(our, kRook, F8) - getPsqtScore(our, kRook, H8);
+          mailbox_[H8] = kEmptyCell;
+          mailbox_[F8] = toMailboxCell(our, kRook);
+        }
+      } else if constexpr (moveType.isQueenSideCastle) {
+        if constexpr (our == kWhite) {
+          bitboards_[our][kRook] = moveSquare(bitboards_[our][kRook], A1, D1);
+          key_ ^= getPieceKey(our, kRook, A1) ^ getPieceKey(our, kRook, D1);
+          psqt_ += getPsqtScore(our, kRook, D1) - getPsqtScore(our, kRook, A1);
+          mailbox_[A1] = kEmptyCell;
+          mailbox_[D1] = toMailboxCell(our, kRook);
+        } else {
+          bitboards_[our][kRook] = moveSquare(bitboards_[our][kRook], A8, D8);
+          key_ ^= getPieceKey(our, kRook, A8) ^ getPieceKey(our, kRook, D8);
+          psqt_ += getPsqtScore(our, kRook, D8) - getPsqtScore(our, kRook, A8);
+          mailbox_[A8] = kEmptyCell;
+          mailbox_[D8] = toMailboxCell(our, kRook);
+        }
+      }
+    }
+
+    key_ ^= getSideKey();
+    color_ = getOtherColor(our);
+    return captured;
+  }
+
+  // Make the move and record what unmakeMove needs to take it back.
+  template <MoveType moveType>
+  constexpr void makeMove(Move<moveType> move, UndoRecord& undo) {
+    undo.key = key_;
+    undo.castlePermission = castlePermission_;
+    undo.psqt = psqt_;
+    undo.enpassant = enpassant_;
+    undo.halfmove = halfmove_;
+    undo.phase = phase_;
+    undo.captured = makeMove(move);
+  }
+
+  // Take back a move made with makeMove(move, undo). The hashed and scored fields are restored from the record.
+  template <MoveType moveType>
+  constexpr void unmakeMove(Move<moveType> move, const UndoRecord& undo) {
+    KITTY_INSTRUMENT_PHASE(instrumentation::kUnmakeMovePhase);
+    constexpr Color our = moveType.color;
+    constexpr Color their = getOtherColor(our);
+    const Square srce = move.srce;
+    const Square dest = move.dest;
+
+    color_ = our;
+    if constexpr (our == kBlack) {
+      --fullmove_;
+    }
+
+    if constexpr (moveType.promotionPiece) {
+      bitboards_[our][moveType.promotionPiece] = unsetSquare(bitboards_[our][moveType.promotionPiece], dest);
+      bitboards_[our][kPawn] = setSquare(bitboards_[our][kPawn], srce);
+    } else {
+      bitboards_[our][moveType.movedPiece] = moveSquare(bitboards_[our][moveType.movedPiece], dest, srce);
+    }
+    mailbox_[srce] = toMailboxCell(our, moveType.movedPiece);
+    mailbox_[dest] = kEmptyCell;
+
+    if constexpr (moveType.isEnpassant) {
+      if constexpr (their == kWhite) {
+        bitboards_[their][kPawn] = setSquare(bitboards_[their][kPawn], squareUp(dest));
+        mailbox_[squareUp(dest)] = toMailboxCell(their, kPawn);
       } else {
-        Receiver::acceptMove(*this, Move<MoveType{our, kKing, 0, false, false, true, false}>(E8, G8));
+        bitboards_[their][kPawn] = setSquare(bitboards_[their][kPawn], squareDown(dest));
+        mailbox_[squareDown(dest)] = toMailboxCell(their, kPawn);
       }
+    } else if (undo.captured != kNoPiece) {
+      bitboards_[their][undo.captured] = setSquare(bitboards_[their][undo.captured], dest);
+      mailbox_[dest] = toMailboxCell(their, undo.captured);
     }
 
-    // Queen Castling
-    if ((castlePermission_ & kQueenCastlePermission[our]) == kQueenCastlePermission[our] && // Check castle permission
-        (bothOccupancy & kQueenCastleOccupancy[our]) == 0 &&                                // Check castle blocker
-        (attackedMask & kQueenCastleSafety[our]) == 0) {                                        // Check castle attacked squares
+    if constexpr (moveType.isKingSideCastle) {
       if constexpr (our == kWhite) {
-        Receiver::acceptMove(*this, Move<MoveType{our, kKing, 0, false, false, false, true}>(E1, C1));
+        bitboards_[our][kRook] = moveSquare(bitboards_[our][kRook], F1, H1);
+        mailbox_[F1] = kEmptyCell;
+        mailbox_[H1] = toMailboxCell(our, kRook);
       } else {
-        Receiver::acceptMove(*this, Move<MoveType{our, kKing, 0, false, false, false, true}>(E8, C8));
+        bitboards_[our][kRook] = moveSquare(bitboards_[our][kRook], F8, H8);
+        mailbox_[F8] = kEmptyCell;
+        mailbox_[H8] = toMailboxCell(our, kRook);
+      }
+    } else if constexpr (moveType.isQueenSideCastle) {
+      if constexpr (our == kWhite) {
+        bitboards_[our][kRook] = moveSquare(bitboards_[our][kRook], D1, A1);
+        mailbox_[D1] = kEmptyCell;
+        mailbox_[A1] = toMailboxCell(our, kRook);
+      } else {
+        bitboards_[our][kRook] = moveSquare(bitboards_[our][kRook], D8, A8);
+        mailbox_[D8] = kEmptyCell;
+        mailbox_[A8] = toMailboxCell(our, kRook);
+      }
+    }
+
+    key_ = undo.key;
+    castlePermission_ = undo.castlePermission;
+    psqt_ = undo.psqt;
+    enpassant_ = undo.enpassant;
+    halfmove_ = undo.halfmove;
+    phase_ = undo.phase;
+  }
+
+  // Replay an encoded move through receiver.acceptMove with its compile-time MoveType.
+  // The move must be legal in this position.
+  template <Color our, typename Receiver>
+  constexpr void dispatchMove(Receiver& receiver, PackedMove move) const {
+    dispatchMove<our>(receiver, move, move.getSrce());
+  }
+
+  // The flag does not name the moved piece of a quiet move or capture, it is looked up on pieceSq.
+  template <Color our, typename Receiver>
+  constexpr void dispatchMove(Receiver& receiver, PackedMove move, Square pieceSq) const {
+    const Square srce = move.getSrce();
+    const Square dest = move.getDest();
+    switch (move.getFlag()) {
+    case PackedMove::kDoublePush: replayMove<MoveType{our, kPawn, 0, false, true, false, false}>(receiver, srce, dest); break;
+    case PackedMove::kKingSideCastle: replayMove<MoveType{our, kKing, 0, false, false, true, false}>(receiver, srce, dest); break;
+    case PackedMove::kQueenSideCastle: replayMove<MoveType{our, kKing, 0, false, false, false, true}>(receiver, srce, dest); break;
+    case PackedMove::kEnpassant: replayMove<MoveType{our, kPawn, 0, true, false, false, false}>(receiver, srce, dest); break;
+    case PackedMove::kPromotion | 0: replayMove<MoveType{our, kPawn, kKnight, false, false, false, false}>(receiver, srce, dest); break;
+    case PackedMove::kPromotion | 1: replayMove<MoveType{our, kPawn, kBishop, false, false, false, false}>(receiver, srce, dest); break;
+    case PackedMove::kPromotion | 2: replayMove<MoveType{our, kPawn, kRook, false, false, false, false}>(receiver, srce, dest); break;
+    case PackedMove::kPromotion | 3: replayMove<MoveType{our, kPawn, kQueen, false, false, false, false}>(receiver, srce, dest); break;
+    default:
+      switch (getPieceAt(our, pieceSq)) {
+      case kPawn: replayMove<MoveType{our, kPawn, 0, false, false, false, false}>(receiver, srce, dest); break;
+      case kKnight: replayMove<MoveType{our, kKnight, 0, false, false, false, false}>(receiver, srce, dest); break;
+      case kBishop: replayMove<MoveType{our, kBishop, 0, false, false, false, false}>(receiver, srce, dest); break;
+      case kRook: replayMove<MoveType{our, kRook, 0, false, false, false, false}>(receiver, srce, dest); break;
+      case kQueen: replayMove<MoveType{our, kQueen, 0, false, false, false, false}>(receiver, srce, dest); break;
+      case kKing: replayMove<MoveType{our, kKing, 0, false, false, false, false}>(receiver, srce, dest); break;
+      default: assert(false && "no piece on the source square"); break;
       }
+      break;
     }
   }
 
-  static BoardState fromFEN(const std::string& fen);
+  // Apply an encoded move in place, through the same specialised make move code.
+  constexpr void makeMove(PackedMove move) {
+    PackedMoveMaker maker{*this};
+    color_ == kWhite ? dispatchMove<kWhite>(maker, move) : dispatchMove<kBlack>(maker, move);
+  }
+
+  constexpr void makeMove(PackedMove move, UndoRecord& undo) {
+    PackedMoveUndoMaker maker{*this, undo};
+    color_ == kWhite ? dispatchMove<kWhite>(maker, move) : dispatchMove<kBlack>(maker, move);
+  }
+
+  // The moved piece now sits on the destination square.
+  constexpr void unmakeMove(PackedMove move, const UndoRecord& undo) {
+    PackedMoveUnmaker unmaker{*this, undo};
+    color_ == kBlack ? dispatchMove<kWhite>(unmaker, move, move.getDest()) : dispatchMove<kBlack>(unmaker, move, move.getDest());
+  }
+
+  // The longest FEN toFEN can write: a full board, all the castle rights and the largest counters.
+  static constexpr size_t kMaxFenLength = 128;
+
+  // Parse without throwing or allocating. The state is only written if the FEN is valid.
+  static FenError parseFEN(std::string_view fen, BoardState& state);
+
+  // For FENs known to be valid, asserts otherwise.
+  static BoardState fromFEN(std::string_view fen);
+
+  // Write the FEN without a terminating null and return its length.
+  // Return 0 and write nothing if the buffer is shorter than kMaxFenLength.
+  size_t toFEN(std::span<char> buffer) const;
+
+  // Encode a UCI long algebraic move from the piece on its source square, without generating the legal moves.
+  // The move is trusted to be legal. Return kNullMove if it is malformed or there is no piece to move.
+  PackedMove parseMove(const std::string& moveString) const;
+
   friend std::ostream& operator<<(std::ostream& out, const BoardState& boardState);
+  constexpr bool operator==(const BoardState&) const = default;
 };
 static_assert(std::is_trivial_v<BoardState>, "BoardState is not POD type, may affect performance");
+
+// One copy-make slot per ply, each starting on its own cache line.
+struct alignas(64) PlyState {
+  BoardState state;
+};
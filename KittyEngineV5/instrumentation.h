@@ -0,0 +1,334 @@
+#pragma once
+///////////////////////////////////////////////////////
+//                 INSTRUMENTATION
+///////////////////////////////////////////////////////
+// Define KITTY_ENABLE_INSTRUMENTATION to count where the move generator spends its time: rdtsc cycles and calls
+// per phase, moves emitted per piece, and how many generated positions are in check or have pins.
+// Without it this header only defines the KITTY_INSTRUMENT macros as nothing and includes nothing else,
+// so the generator compiles to exactly the same code as without the hooks.
+#ifdef KITTY_ENABLE_INSTRUMENTATION
+#include "bitboard.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <format>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+namespace instrumentation {
+  // A phase only counts its own cycles, the phases nested in it are taken out. Generate is the rest of
+  // enumerateMoves. A receiver that recurses, like perft, runs the child positions inside the emitting phase,
+  // so making and unmaking the moves are phases of their own.
+  enum Phase : uint32_t {
+    kGeneratePhase,
+    kCheckedMaskPhase,
+    kPinnedMaskPhase,
+    kAttackedMaskPhase,
+    kKnightMovePhase,
+    kBishopMovePhase,
+    kRookMovePhase,
+    kQueenMovePhase,
+    kPawnMovePhase,
+    kEnpassantPhase,
+    kKingMovePhase,
+    kMakeMovePhase,
+    kUnmakeMovePhase,
+    kPhaseSize,
+  };
+
+  enum NodeCounter : uint32_t {
+    kNodeCounter,  // One per enumerateMoves call.
+    kCheckNodeCounter,
+    kDoubleCheckNodeCounter,
+    kPinNodeCounter,
+    kNodeCounterSize,
+  };
+
+  inline constexpr std::array<const char*, kPhaseSize> kPhaseNames = {
+    "generate", "checked mask", "pinned mask", "attacked mask", "knight moves", "bishop moves", "rook moves",
+    "queen moves", "pawn moves", "enpassant", "king moves", "make move", "unmake move",
+  };
+
+  [[nodiscard]] inline constexpr Phase getPieceMovePhase(Piece piece) {
+    return static_cast<Phase>(kKnightMovePhase + (piece - kKnight));
+  }
+
+  // The totals of one thread, or of every thread added up.
+  struct Snapshot {
+    std::array<uint64_t, kPhaseSize> calls;
+    std::array<uint64_t, kPhaseSize> cycles;
+    std::array<uint64_t, kPieceSize> moves;
+    std::array<uint64_t, kNodeCounterSize> nodes;
+  };
+
+  namespace internal {
+    // Only the owner thread writes its counters, so a relaxed load and store is enough, without a locked add.
+    // Other threads may read them at any time for a snapshot.
+    struct Counters {
+      std::array<std::atomic<uint64_t>, kPhaseSize> calls;
+      std::array<std::atomic<uint64_t>, kPhaseSize> cycles;
+      std::array<std::atomic<uint64_t>, kPieceSize> moves;
+      std::array<std::atomic<uint64_t>, kNodeCounterSize> nodes;
+    };
+
+    inline void add(std::atomic<uint64_t>& counter, uint64_t value) {
+      counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    template <size_t size>
+    inline void addTo(std::array<uint64_t, size>& totals, const std::array<std::atomic<uint64_t>, size>& counters) {
+      for (size_t i = 0; i < size; ++i) {
+        totals[i] += counters[i].load(std::memory_order_relaxed);
+      }
+    }
+
+    // The counters of the live threads, and the totals of the threads that have exited.
+    struct Registry {
+      std::mutex mutex;
+      std::vector<Counters*> counters;
+      Snapshot retired;
+    };
+
+    inline Registry& getRegistry() {
+      static Registry registry;
+      return registry;
+    }
+
+    inline void addTo(Snapshot& snapshot, const Counters& counters) {
+      addTo(snapshot.calls, counters.calls);
+      addTo(snapshot.cycles, counters.cycles);
+      addTo(snapshot.moves, counters.moves);
+      addTo(snapshot.nodes, counters.nodes);
+    }
+
+    // Registered on the first count in a thread, folded into the retired totals when the thread exits.
+    struct ThreadCounters {
+      Counters counters{};
+
+      ThreadCounters() {
+        Registry& registry = getRegistry();
+        std::lock_guard lock(registry.mutex);
+        registry.counters.push_back(&counters);
+      }
+
+      ~ThreadCounters() {
+        Registry& registry = getRegistry();
+        std::lock_guard lock(registry.mutex);
+        addTo(registry.retired, counters);
+        std::erase(registry.counters, &counters);
+      }
+    };
+
+    inline Counters& getThreadCounters() {
+      thread_local ThreadCounters threadCounters;
+      return threadCounters.counters;
+    }
+
+    inline uint64_t readCycles() {
+      return __rdtsc();
+    }
+
+    // What a nested phase still costs its parent outside of the span it takes out, mostly the latency of a read.
+    // Measured once as the median over a parent and a child that both only read the counter.
+    inline uint64_t getNestedOverhead() {
+      static const uint64_t overhead = []() {
+        std::array<uint64_t, 1 << 10> samples;
+        for (uint64_t& sample : samples) {
+          const uint64_t parentStart = readCycles();
+          const uint64_t childStart = readCycles();
+          const uint64_t childEnd = readCycles();
+          const uint64_t parentEnd = readCycles();
+          sample = (parentEnd - parentStart) - (childEnd - childStart);
+        }
+        std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+        return samples[samples.size() / 2];
+      }();
+      return overhead;
+    }
+  }
+
+  // Add up every thread. Counts from threads that are still running may be a little behind.
+  inline Snapshot getSnapshot() {
+    internal::Registry& registry = internal::getRegistry();
+    std::lock_guard lock(registry.mutex);
+    Snapshot snapshot = registry.retired;
+    for (const internal::Counters* counters : registry.counters) {
+      internal::addTo(snapshot, *counters);
+    }
+    return snapshot;
+  }
+
+  // Only call between runs, a thread that is counting at the same time may keep part of its old counts.
+  inline void reset() {
+    internal::Registry& registry = internal::getRegistry();
+    std::lock_guard lock(registry.mutex);
+    registry.retired = {};
+    const auto clear = [](auto& group) {
+      for (std::atomic<uint64_t>& counter : group) {
+        counter.store(0, std::memory_order_relaxed);
+      }
+    };
+    for (internal::Counters* counters : registry.counters) {
+      clear(counters->calls);
+      clear(counters->cycles);
+      clear(counters->moves);
+      clear(counters->nodes);
+    }
+  }
+
+  // The counting hooks are constexpr, so the instrumented generator can still run at compile time, uncounted.
+  inline constexpr void countNode(NodeCounter counter, bool isCounted) {
+    if (!std::is_constant_evaluated() && isCounted) {
+      internal::add(internal::getThreadCounters().nodes[counter], 1);
+    }
+  }
+
+  inline constexpr void countMoves(Piece piece, uint64_t count) {
+    if (!std::is_constant_evaluated()) {
+      internal::add(internal::getThreadCounters().moves[piece], count);
+    }
+  }
+
+  // Count the cycles from construction to the end of the scope against the phase, less those of the phases inside it.
+  // A nested phase takes its whole span out of the parent, bookkeeping included, and the calibrated overhead of its
+  // counter reads, so the hooks are charged to neither.
+  class ScopedPhase {
+    static inline thread_local ScopedPhase* active_ = nullptr;
+
+    Phase phase_;
+    ScopedPhase* parent_;
+    uint64_t entered_;  // Before the bookkeeping, start_ is after it.
+    uint64_t start_;
+    uint64_t nestedCycles_;
+
+  public:
+    constexpr explicit ScopedPhase(Phase phase) : phase_(phase), parent_(nullptr), entered_(0), start_(0), nestedCycles_(0) {
+      if (!std::is_constant_evaluated()) {
+        entered_ = internal::readCycles();
+        parent_ = active_;
+        active_ = this;
+        start_ = internal::readCycles();
+      }
+    }
+
+    constexpr ~ScopedPhase() {
+      if (!std::is_constant_evaluated()) {
+        const uint64_t cycles = internal::readCycles() - start_;
+        internal::Counters& counters = internal::getThreadCounters();
+        internal::add(counters.cycles[phase_], cycles - std::min(cycles, nestedCycles_));
+        internal::add(counters.calls[phase_], 1);
+        active_ = parent_;
+        if (parent_) {
+          parent_->nestedCycles_ += internal::readCycles() - entered_ + internal::getNestedOverhead();
+        }
+      }
+    }
+
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+  };
+
+  inline void printReport(std::ostream& out, const Snapshot& snapshot) {
+    using std::format;
+
+    uint64_t totalCycles = 0;
+    for (uint64_t cycles : snapshot.cycles) {
+      totalCycles += cycles;
+    }
+    const auto percent = [](uint64_t part, uint64_t whole) { return 100.0 * static_cast<double>(part) / static_cast<double>(std::max<uint64_t>(whole, 1)); };
+
+    out << format("{:<14} {:>14} {:>16} {:>12} {:>8}\n", "phase", "calls", "cycles", "cycles/call", "share");
+    for (uint32_t phase = 0; phase < kPhaseSize; ++phase) {
+      out << format("{:<14} {:>14} {:>16} {:>12.1f} {:>7.1f}%\n", kPhaseNames[phase], snapshot.calls[phase], snapshot.cycles[phase],
+                    static_cast<double>(snapshot.cycles[phase]) / static_cast<double>(std::max<uint64_t>(snapshot.calls[phase], 1)),
+                    percent(snapshot.cycles[phase], totalCycles));
+    }
+
+    uint64_t totalMoves = 0;
+    for (uint64_t moves : snapshot.moves) {
+      totalMoves += moves;
+    }
+    out << "moves";
+    for (Piece piece = kPawn; piece < kNoPiece; ++piece) {
+      out << format(" {} {} ({:.1f}%)", pieceToAsciiVisualOnly(kWhite, piece), snapshot.moves[piece], percent(snapshot.moves[piece], totalMoves));
+    }
+
+    const uint64_t nodes = snapshot.nodes[kNodeCounter];
+    out << format("\ngenerated positions {}, in check {:.2f}%, double check {:.2f}%, with pins {:.2f}%\n", nodes,
+                  percent(snapshot.nodes[kCheckNodeCounter], nodes), percent(snapshot.nodes[kDoubleCheckNodeCounter], nodes),
+                  percent(snapshot.nodes[kPinNodeCounter], nodes));
+  }
+
+  // Print the elapsed time, the node count and the speed over the last interval and overall from a background thread,
+  // every interval until it is destroyed. Meant for runs long enough that the end result is a long wait.
+  class ProgressSampler {
+    std::ostream& out_;
+    std::chrono::milliseconds interval_;
+    std::function<uint64_t()> getNodes_;
+    std::mutex mutex_;
+    std::condition_variable stopCondition_;
+    bool isStopping_;
+    std::thread thread_;
+
+    void sampleLoop() {
+      using namespace std::chrono;
+      const auto start = steady_clock::now();
+      auto last = start;
+      uint64_t lastNodes = getNodes_();
+      std::unique_lock lock(mutex_);
+      while (!stopCondition_.wait_for(lock, interval_, [this]() { return isStopping_; })) {
+        const auto now = steady_clock::now();
+        const uint64_t nodes = getNodes_();
+        const auto knps = [](uint64_t count, steady_clock::duration time) {
+          return count / std::max<uint64_t>(duration_cast<milliseconds>(time).count(), 1);
+        };
+        out_ << std::format("progress {:.1f} s, nodes {}, speed {} knps, overall {} knps\n",
+                            duration<double>(now - start).count(), nodes, knps(nodes - lastNodes, now - last), knps(nodes, now - start));
+        out_.flush();
+        last = now;
+        lastNodes = nodes;
+      }
+    }
+
+  public:
+    ProgressSampler(std::ostream& out, std::chrono::milliseconds interval, std::function<uint64_t()> getNodes)
+      : out_(out), interval_(interval), getNodes_(std::move(getNodes)), mutex_(), stopCondition_(), isStopping_(false), thread_() {
+      thread_ = std::thread([this]() { sampleLoop(); });
+    }
+
+    ProgressSampler(const ProgressSampler&) = delete;
+    ProgressSampler& operator=(const ProgressSampler&) = delete;
+
+    ~ProgressSampler() {
+      {
+        std::lock_guard lock(mutex_);
+        isStopping_ = true;
+      }
+      stopCondition_.notify_all();
+      thread_.join();
+    }
+  };
+}
+
+#define KITTY_INSTRUMENT_CONCAT_IMPL(a, b) a##b
+#define KITTY_INSTRUMENT_CONCAT(a, b) KITTY_INSTRUMENT_CONCAT_IMPL(a, b)
+#define KITTY_INSTRUMENT_PHASE(phase) const instrumentation::ScopedPhase KITTY_INSTRUMENT_CONCAT(kittyScopedPhase, __LINE__)(phase)
+#define KITTY_INSTRUMENT_NODE(counter, condition) instrumentation::countNode(counter, condition)
+#define KITTY_INSTRUMENT_MOVES(piece, count) instrumentation::countMoves(piece, count)
+#else
+#define KITTY_INSTRUMENT_PHASE(phase)
+#define KITTY_INSTRUMENT_NODE(counter, condition)
+#define KITTY_INSTRUMENT_MOVES(piece, count)
+#endif
@@ -1,37 +1,86 @@
+#include "benchmark.h"
+#include "bitbase.h"
 #include "board.h"
-#include "perft_driver.h"
+#include "perft_suite.h"
+#include "search.h"
+#include "uci.h"
+#include <array>
+#include <fstream>
+#include <format>
 #include <iostream>
+#include <string>
+#include <string_view>
 
 using namespace std;
 
-void runPerft() {
-  constexpr perft::Config config{ false, true, false };
-  const BoardState initialPositionState = BoardState::fromFEN("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
-  const BoardState kiwipeteState = BoardState::fromFEN("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ");
-  const BoardState rookEndGameState = BoardState::fromFEN("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - ");
-  const BoardState mirrorViewState = BoardState::fromFEN("r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1");
-  const BoardState talkChessBugState = BoardState::fromFEN("rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8");
-  const BoardState stevenAltState = BoardState::fromFEN("r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10");
+void runSearch() {
+  constexpr uint32_t kDepth = 6;
+  const std::array<const char*, 6> fens = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - ",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - ",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+  };
 
-  cout << "Initial Position\n";
-  for (int i = 1; i <= 7; ++i) {
-    perft::runPerft<config>(initialPositionState, i);
-    perft::runPerft<config>(initialPositionState, i);
+  for (const char* fen : fens) {
+    const search::Result result = search::search(BoardState::fromFEN(fen), { .depth = kDepth });
+    cout << format("depth {}, best {}, score {}, nodes {}, time {}, speed {} knps\n",
+                   result.depth, moveToString(result.bestMove), result.score, result.nodes, result.time, result.nps / 1000);
   }
+}
 
-  cout << "Kiwipete\n";
-  for (int i = 1; i <= 6; ++i) {
-    perft::runPerft<config>(kiwipeteState, i);
-    perft::runPerft<config>(kiwipeteState, i);
+int main(int argc, char* argv[]) {
+  if (argc > 1 && std::string_view(argv[1]) == "bench") {
+    if (argc > 2 && std::string_view(argv[2]) == "bitbase") {
+      bench::runBitbaseBenchmark(argc > 3 ? static_cast<uint32_t>(std::stoul(argv[3])) : perft::getDefaultThreadCount());
+    } else if (argc > 2 && std::string_view(argv[2]) == "book") {
+      bench::runBookBenchmark(argc > 3 ? argv[3] : "");
+    } else if (argc > 2 && std::string_view(argv[2]) == "capture") {
+      bench::runCaptureBenchmark();
+    } else if (argc > 2 && std::string_view(argv[2]) == "instrument") {
+      bench::runInstrumentationBenchmark(argc > 3 ? static_cast<uint32_t>(std::stoul(argv[3])) : 5);
+    } else if (argc > 2 && std::string_view(argv[2]) == "make") {
+      bench::runMakeMoveBenchmark();
+    } else if (argc > 2 && std::string_view(argv[2]) == "nnue") {
+      bench::runNnueBenchmark(argc > 3 ? argv[3] : "");
+    } else if (argc > 2 && std::string_view(argv[2]) == "quiescence") {
+      bench::runQuiescenceBenchmark(argc > 3 ? static_cast<uint32_t>(std::stoul(argv[3])) : 6);
+    } else if (argc > 2 && std::string_view(argv[2]) == "see") {
+      bench::runSeeBenchmark();
+    } else if (argc > 2 && std::string_view(argv[2]) == "smp") {
+      bench::runSmpBenchmark(argc > 3 ? static_cast<uint32_t>(std::stoul(argv[3])) : 9);
+    } else {
+      bench::runSliderAttackBenchmark();
+    }
+    return 0;
   }
-
-  cout << "Rook Endgame\n";
-  for (int i = 1; i <= 7; ++i) {
-    perft::runPerft<config>(rookEndGameState, i);
-    perft::runPerft<config>(rookEndGameState, i);
+  if (argc > 2 && std::string_view(argv[1]) == "epd") {
+    // epd <file> [max depth] [threads], exits with 1 if any count is wrong.
+    std::ifstream file(argv[2]);
+    if (!file) {
+      cout << format("can not open {}\n", argv[2]);
+      return 1;
+    }
+    const uint32_t maxDepth = (argc > 3 ? static_cast<uint32_t>(std::stoul(argv[3])) : 15);
+    const uint32_t threadCount = (argc > 4 ? static_cast<uint32_t>(std::stoul(argv[4])) : perft::getDefaultThreadCount());
+    return (perft::runSuite(file, cout, maxDepth, threadCount).failures == 0 ? 0 : 1);
   }
-}
-
-int main() {
-  runPerft();
+  if (argc > 2 && std::string_view(argv[1]) == "bitbase") {
+    // bitbase <header> [threads], writes the generated tables as source to embed.
+    std::ofstream file(argv[2]);
+    if (!file) {
+      cout << format("can not open {}\n", argv[2]);
+      return 1;
+    }
+    bitbase::Tables::generate(argc > 3 ? static_cast<uint32_t>(std::stoul(argv[3])) : perft::getDefaultThreadCount()).writeSource(file);
+    return 0;
+  }
+  if (argc > 1 && std::string_view(argv[1]) == "search") {
+    runSearch();
+    return 0;
+  }
+  uci::Engine engine(cout);
+  engine.loop(cin);
 }
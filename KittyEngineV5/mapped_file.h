@@ -0,0 +1,110 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+///////////////////////////////////////////////////////
+//                 MAPPED FILE
+///////////////////////////////////////////////////////
+// A read only memory mapping of a whole file. Pages are read in by the OS on first touch, nothing is copied up front.
+class MappedFile {
+  const std::byte* data_;
+  size_t size_;
+#ifdef _WIN32
+  HANDLE mapping_;
+#endif
+
+  MappedFile() : data_(nullptr), size_(0)
+#ifdef _WIN32
+    , mapping_(nullptr)
+#endif
+  {
+  }
+
+public:
+  enum Access : uint32_t {
+    kSequentialAccess,
+    kRandomAccess,
+  };
+
+  // Return nullptr if the file can not be opened or mapped. An empty file maps to no data.
+  static std::unique_ptr<MappedFile> open(const std::string& path, Access access) {
+    std::unique_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+    const DWORD flags = (access == kSequentialAccess ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS);
+    const HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+      return nullptr;
+    }
+    LARGE_INTEGER size{};
+    const bool hasSize = GetFileSizeEx(handle, &size);
+    file->size_ = static_cast<size_t>(size.QuadPart);
+    if (hasSize && file->size_ != 0) {
+      file->mapping_ = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      file->data_ = static_cast<const std::byte*>(file->mapping_ ? MapViewOfFile(file->mapping_, FILE_MAP_READ, 0, 0, 0) : nullptr);
+    }
+    CloseHandle(handle);
+#else
+    const int descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+      return nullptr;
+    }
+    struct stat status{};
+    const bool hasSize = fstat(descriptor, &status) == 0;
+    file->size_ = static_cast<size_t>(status.st_size);
+    if (hasSize && file->size_ != 0) {
+      void* data = mmap(nullptr, file->size_, PROT_READ, MAP_PRIVATE, descriptor, 0);
+      if (data != MAP_FAILED) {
+        madvise(data, file->size_, access == kSequentialAccess ? MADV_SEQUENTIAL : MADV_RANDOM);
+        file->data_ = static_cast<const std::byte*>(data);
+      }
+    }
+    close(descriptor);
+#endif
+    if (!hasSize || (file->size_ != 0 && !file->data_)) {
+      return nullptr;
+    }
+    return file;
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+#ifdef _WIN32
+    if (data_) {
+      UnmapViewOfFile(data_);
+    }
+    if (mapping_) {
+      CloseHandle(mapping_);
+    }
+#else
+    if (data_) {
+      munmap(const_cast<std::byte*>(data_), size_);
+    }
+#endif
+  }
+
+  const std::byte* getData() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+};
@@ -1,5 +1,8 @@
 #pragma once
 #include "bitboard.h"
+#include <compare>
+#include <functional>
+#include <string>
 #include <type_traits>
 
 struct MoveType {
@@ -17,3 +20,93 @@ struct Move {
   Square srce;
   Square dest;
 };
+
+// A runtime move packed in 16 bits, so it can be stored, sorted, hashed and passed across threads.
+// Bits 0-5 source, bits 6-11 destination, bits 12-15 flag.
+class PackedMove {
+  uint16_t data_;
+
+public:
+  enum Flag : uint16_t {
+    kQuiet = 0,
+    kDoublePush = 1,
+    kKingSideCastle = 2,
+    kQueenSideCastle = 3,
+    kEnpassant = 5,
+    kPromotion = 8,  // kPromotion | (promotionPiece - kKnight)
+  };
+
+  PackedMove() = default;
+  constexpr PackedMove(Square srce, Square dest, uint16_t flag)
+    : data_(static_cast<uint16_t>(srce | dest << 6 | flag << 12)) {}
+
+  template <MoveType moveType>
+  static constexpr PackedMove fromMove(Move<moveType> move) {
+    if constexpr (moveType.promotionPiece) {
+      return PackedMove(move.srce, move.dest, static_cast<uint16_t>(kPromotion | (moveType.promotionPiece - kKnight)));
+    } else if constexpr (moveType.isEnpassant) {
+      return PackedMove(move.srce, move.dest, kEnpassant);
+    } else if constexpr (moveType.isDoublePush) {
+      return PackedMove(move.srce, move.dest, kDoublePush);
+    } else if constexpr (moveType.isKingSideCastle) {
+      return PackedMove(move.srce, move.dest, kKingSideCastle);
+    } else if constexpr (moveType.isQueenSideCastle) {
+      return PackedMove(move.srce, move.dest, kQueenSideCastle);
+    } else {
+      return PackedMove(move.srce, move.dest, kQuiet);
+    }
+  }
+
+  constexpr Square getSrce() const {
+    return data_ & 0x3f;
+  }
+
+  constexpr Square getDest() const {
+    return data_ >> 6 & 0x3f;
+  }
+
+  constexpr uint16_t getFlag() const {
+    return data_ >> 12;
+  }
+
+  constexpr bool isPromotion() const {
+    return getFlag() & kPromotion;
+  }
+
+  constexpr Piece getPromotionPiece() const {
+    return isPromotion() ? static_cast<Piece>(kKnight + (getFlag() & 3)) : kPawn;
+  }
+
+  constexpr uint16_t getData() const {
+    return data_;
+  }
+
+  static constexpr PackedMove fromData(uint16_t data) {
+    return PackedMove(static_cast<Square>(data & 0x3f), static_cast<Square>(data >> 6 & 0x3f), static_cast<uint16_t>(data >> 12));
+  }
+
+  constexpr bool isNull() const {
+    return data_ == 0;
+  }
+
+  constexpr auto operator<=>(const PackedMove&) const = default;
+};
+static_assert(sizeof(PackedMove) == 2 && std::is_trivial_v<PackedMove>, "PackedMove must stay a trivial 16-bit value");
+
+inline constexpr PackedMove kNullMove = PackedMove(0, 0, PackedMove::kQuiet);
+
+template <>
+struct std::hash<PackedMove> {
+  size_t operator()(PackedMove move) const noexcept {
+    return std::hash<uint16_t>{}(move.getData());
+  }
+};
+
+// Long algebraic notation, as used by UCI. Eg. e2e4, e7e8q.
+inline std::string moveToString(PackedMove move) {
+  std::string str = squareToString(move.getSrce()) + squareToString(move.getDest());
+  if (move.isPromotion()) {
+    str += pieceToAscii(kBlack, move.getPromotionPiece());
+  }
+  return str;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "board.h"
+#include <array>
+
+///////////////////////////////////////////////////////
+//                 MOVE LIST
+///////////////////////////////////////////////////////
+// A stack allocated receiver that collects the encoded moves from enumerateMoves.
+// The most legal moves in any position is 218, so it never overflows.
+class MoveList {
+public:
+  static constexpr size_t kCapacity = 256;
+
+private:
+  std::array<PackedMove, kCapacity> moves_;
+  uint32_t size_;
+
+public:
+  constexpr MoveList() : size_(0) {}
+
+  template <MoveType moveType>
+  constexpr void acceptMove(const BoardState&, Move<moveType> move) {
+    assert(size_ < kCapacity);
+    moves_[size_++] = PackedMove::fromMove(move);
+  }
+
+  // Fill the list with the legal moves of the side to move, restricted to the generation type.
+  template <GenerationType genType = kAllMoves>
+  static constexpr MoveList fromState(const BoardState& state) {
+    MoveList moves;
+    state.getColor() == kWhite ? state.enumerateMoves<kWhite, genType>(moves) : state.enumerateMoves<kBlack, genType>(moves);
+    return moves;
+  }
+
+  constexpr uint32_t size() const {
+    return size_;
+  }
+
+  constexpr bool empty() const {
+    return size_ == 0;
+  }
+
+  constexpr void clear() {
+    size_ = 0;
+  }
+
+  constexpr PackedMove& operator[](size_t i) {
+    return moves_[i];
+  }
+
+  constexpr const PackedMove& operator[](size_t i) const {
+    return moves_[i];
+  }
+
+  constexpr PackedMove* begin() {
+    return moves_.data();
+  }
+
+  constexpr PackedMove* end() {
+    return moves_.data() + size_;
+  }
+
+  constexpr const PackedMove* begin() const {
+    return moves_.data();
+  }
+
+  constexpr const PackedMove* end() const {
+    return moves_.data() + size_;
+  }
+};
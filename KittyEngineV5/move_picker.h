@@ -0,0 +1,177 @@
+#pragma once
+#include "board.h"
+#include "move_list.h"
+#include <algorithm>
+#include <array>
+#include <utility>
+
+///////////////////////////////////////////////////////
+//                 MOVE PICKER
+///////////////////////////////////////////////////////
+namespace search {
+  // Quiet moves that caused a beta cutoff, indexed by color, source and destination.
+  using HistoryTable = std::array<std::array<std::array<int32_t, kSquareSize>, kSquareSize>, kColorSize>;
+
+  // Quiet moves tried right after the good captures: two killers of the ply, then the counter move to the last move.
+  using Refutations = std::array<PackedMove, 3>;
+
+  // Hand out the legal moves of a node best first, generating each group only when the search gets to it,
+  // so a node that cuts off on the hash move or a capture never generates its quiets.
+  // Order: hash move, captures that do not lose material by MVV-LVA, refutations, quiets by history, losing captures.
+  // The quiescence picker stops after the captures that do not lose material.
+  template <Color our>
+  class MovePicker {
+    enum Stage : uint32_t {
+      kHashStage,
+      kGenerateCapturesStage,
+      kGoodCapturesStage,
+      kRefutationsStage,
+      kGenerateQuietsStage,
+      kQuietsStage,
+      kBadCapturesStage,
+      kDoneStage,
+    };
+
+    const BoardState& state_;
+    const HistoryTable& history_;
+    PackedMove hashMove_;
+    Refutations refutations_;
+    uint32_t quietRotation_;
+    Stage stage_;
+    bool isCapturesOnly_;
+
+    // Losing captures are moved to the front as they are found, [0, badEnd_) is replayed last.
+    // The quiets are appended after the captures.
+    MoveList moves_;
+    std::array<int32_t, MoveList::kCapacity> scores_;
+    uint32_t cursor_;
+    uint32_t badEnd_;
+    uint32_t refutationIndex_;
+
+    // Most valuable victim first, then least valuable attacker. A promotion counts the promoted piece as won.
+    int32_t getCaptureScore(PackedMove move) const {
+      const Piece victim = (move.getFlag() == PackedMove::kEnpassant ? kPawn : state_.getPieceAt(move.getDest()));
+      const int32_t promotion = (move.isPromotion() ? kSeeValues[move.getPromotionPiece()] : 0);
+      return (kSeeValues[victim] + promotion) * 8 - static_cast<int32_t>(state_.getPieceAt(move.getSrce()));
+    }
+
+    // Stable insertion sort by history, the quiet lists are short and it does not allocate.
+    void sortQuiets(PackedMove* begin, PackedMove* end) const {
+      for (PackedMove* it = begin; it != end; ++it) {
+        const PackedMove move = *it;
+        const int32_t value = history_[our][move.getSrce()][move.getDest()];
+        PackedMove* hole = it;
+        for (; hole != begin && history_[our][(hole - 1)->getSrce()][(hole - 1)->getDest()] < value; --hole) {
+          *hole = *(hole - 1);
+        }
+        *hole = move;
+      }
+    }
+
+    bool isRefutation(PackedMove move) const {
+      return move == refutations_[0] || move == refutations_[1] || move == refutations_[2];
+    }
+
+  public:
+    // Helper threads pass a quiet rotation, so equal history quiets come out in another order for each of them.
+    MovePicker(const BoardState& state, PackedMove hashMove, const Refutations& refutations, const HistoryTable& history, uint32_t quietRotation = 0)
+      : state_(state), history_(history), hashMove_(hashMove), refutations_(refutations), quietRotation_(quietRotation),
+        stage_(kHashStage), isCapturesOnly_(false), moves_(), scores_(), cursor_(0), badEnd_(0), refutationIndex_(0) {}
+
+    // Captures and queen promotions only, the losing captures are dropped instead of replayed.
+    MovePicker(const BoardState& state, const HistoryTable& history)
+      : state_(state), history_(history), hashMove_(kNullMove), refutations_(), quietRotation_(0),
+        stage_(kGenerateCapturesStage), isCapturesOnly_(true), moves_(), scores_(), cursor_(0), badEnd_(0), refutationIndex_(0) {}
+
+    // Return the next legal move, or kNullMove once every move has been handed out.
+    PackedMove next() {
+      switch (stage_) {
+      case kHashStage:
+        stage_ = kGenerateCapturesStage;
+        if (state_.template isLegal<our>(hashMove_)) {
+          return hashMove_;
+        }
+        hashMove_ = kNullMove;
+        [[fallthrough]];
+
+      case kGenerateCapturesStage:
+        state_.template enumerateMoves<our, kCaptureMoves>(moves_);
+        for (uint32_t i = 0; i < moves_.size(); ++i) {
+          scores_[i] = getCaptureScore(moves_[i]);
+        }
+        stage_ = kGoodCapturesStage;
+        [[fallthrough]];
+
+      case kGoodCapturesStage:
+        // Selection sort one move at a time, most nodes cut off long before the list is sorted.
+        while (cursor_ < moves_.size()) {
+          uint32_t best = cursor_;
+          for (uint32_t i = cursor_ + 1; i < moves_.size(); ++i) {
+            best = (scores_[i] > scores_[best] ? i : best);
+          }
+          std::swap(moves_[cursor_], moves_[best]);
+          std::swap(scores_[cursor_], scores_[best]);
+          const PackedMove move = moves_[cursor_++];
+          if (move == hashMove_) {
+            continue;
+          }
+          if (!state_.template seeGe<our>(move, 0)) {
+            moves_[badEnd_++] = move;
+            continue;
+          }
+          return move;
+        }
+        if (isCapturesOnly_) {
+          stage_ = kDoneStage;
+          return kNullMove;
+        }
+        stage_ = kRefutationsStage;
+        [[fallthrough]];
+
+      case kRefutationsStage:
+        while (refutationIndex_ < refutations_.size()) {
+          const PackedMove move = refutations_[refutationIndex_++];
+          const bool isRepeated = (refutationIndex_ > 1 && move == refutations_[0]) || (refutationIndex_ > 2 && move == refutations_[1]);
+          if (move != hashMove_ && !isRepeated && !state_.isCaptureMove(move) && state_.template isLegal<our>(move)) {
+            return move;
+          }
+        }
+        stage_ = kGenerateQuietsStage;
+        [[fallthrough]];
+
+      case kGenerateQuietsStage: {
+        PackedMove* const quietBegin = moves_.end();
+        state_.template enumerateMoves<our, kQuietMoves>(moves_);
+        if (quietRotation_ && quietBegin != moves_.end()) {
+          std::rotate(quietBegin, quietBegin + quietRotation_ % (moves_.end() - quietBegin), moves_.end());
+        }
+        sortQuiets(quietBegin, moves_.end());
+        stage_ = kQuietsStage;
+      }
+        [[fallthrough]];
+
+      case kQuietsStage:
+        while (cursor_ < moves_.size()) {
+          const PackedMove move = moves_[cursor_++];
+          if (move != hashMove_ && !isRefutation(move)) {
+            return move;
+          }
+        }
+        cursor_ = 0;
+        stage_ = kBadCapturesStage;
+        [[fallthrough]];
+
+      case kBadCapturesStage:
+        if (cursor_ < badEnd_) {
+          return moves_[cursor_++];
+        }
+        stage_ = kDoneStage;
+        [[fallthrough]];
+
+      case kDoneStage:
+        return kNullMove;
+      }
+      return kNullMove;
+    }
+  };
+}
@@ -0,0 +1,202 @@
+#pragma once
+#include "board.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+///////////////////////////////////////////////////////
+//                 NNUE EVALUATION
+///////////////////////////////////////////////////////
+// A 768 -> 256x2 -> 1 perspective network. Each side has its own accumulator over the 768 piece, color and square
+// features seen from its side of the board, kept up to date from the moves instead of recomputed per position.
+// The hidden layer is a clipped ReLU, and the output is an integer dot product, quantized by kQA and kQB.
+namespace nnue {
+  inline constexpr size_t kInputSize = 768;
+  inline constexpr size_t kHiddenSize = 256;
+  inline constexpr int32_t kQA = 255;
+  inline constexpr int32_t kQB = 64;
+  inline constexpr int32_t kScale = 400;
+
+  // The weights file is this struct as little endian int16 in declaration order, the layout bullet trainers write.
+  // Feature weights are stored one hidden column per feature, so an update adds or subtracts whole columns.
+  struct Network {
+    alignas(64) std::array<int16_t, kInputSize * kHiddenSize> featureWeights;
+    alignas(64) std::array<int16_t, kHiddenSize> featureBias;
+    alignas(64) std::array<int16_t, 2 * kHiddenSize> outputWeights;  // Side to move half first.
+    int16_t outputBias;
+
+    // Return nullptr if the file can not be opened or is shorter than the network.
+    static std::unique_ptr<Network> load(const std::string& path) {
+      std::ifstream file(path, std::ios::binary);
+      auto network = std::make_unique<Network>();
+      const auto read = [&file](auto& values) {
+        file.read(reinterpret_cast<char*>(&values), sizeof(values));
+      };
+      read(network->featureWeights);
+      read(network->featureBias);
+      read(network->outputWeights);
+      read(network->outputBias);
+      return (file ? std::move(network) : nullptr);
+    }
+  };
+
+  struct alignas(64) Accumulator {
+    std::array<std::array<int16_t, kHiddenSize>, kColorSize> values;  // Indexed by perspective.
+  };
+
+  // Both colors see their own pieces first and their own back rank as rank 1.
+  [[nodiscard]] inline constexpr size_t getFeatureIndex(Color perspective, Color color, Piece piece, Square square) {
+    const Square relativeSquare = (perspective == kWhite ? square ^ 56 : square);
+    return (color == perspective ? 0 : 384) + static_cast<size_t>(piece) * kSquareSize + relativeSquare;
+  }
+
+  namespace internal {
+    // A move adds and removes a fixed number of columns, so each combination gets its own fully unrolled kernel.
+    template <size_t addCount, size_t subCount>
+    using Columns = std::pair<std::array<const int16_t*, addCount>, std::array<const int16_t*, subCount>>;
+
+    // out = in + the add columns - the sub columns, wrapping like the SIMD lanes.
+    template <size_t addCount, size_t subCount>
+    inline void applyColumnsScalar(int16_t* out, const int16_t* in, const Columns<addCount, subCount> columns) {
+      for (size_t i = 0; i < kHiddenSize; ++i) {
+        int16_t value = in[i];
+        for (const int16_t* column : columns.first) {
+          value = static_cast<int16_t>(value + column[i]);
+        }
+        for (const int16_t* column : columns.second) {
+          value = static_cast<int16_t>(value - column[i]);
+        }
+        out[i] = value;
+      }
+    }
+
+    inline int32_t dotClippedScalar(const int16_t* values, const int16_t* weights) {
+      int32_t sum = 0;
+      for (size_t i = 0; i < kHiddenSize; ++i) {
+        sum += std::clamp<int32_t>(values[i], 0, kQA) * weights[i];
+      }
+      return sum;
+    }
+
+#ifdef __AVX2__
+    // 16 lanes per register. Each chunk is loaded once, updated by every column and stored once.
+    // The columns are taken by value, so a store can not alias them and force a reload.
+    template <size_t addCount, size_t subCount>
+    inline void applyColumnsAvx2(int16_t* out, const int16_t* in, const Columns<addCount, subCount> columns) {
+      for (size_t i = 0; i < kHiddenSize; i += 16) {
+        __m256i value = _mm256_load_si256(reinterpret_cast<const __m256i*>(in + i));
+        for (const int16_t* column : columns.first) {
+          value = _mm256_add_epi16(value, _mm256_load_si256(reinterpret_cast<const __m256i*>(column + i)));
+        }
+        for (const int16_t* column : columns.second) {
+          value = _mm256_sub_epi16(value, _mm256_load_si256(reinterpret_cast<const __m256i*>(column + i)));
+        }
+        _mm256_store_si256(reinterpret_cast<__m256i*>(out + i), value);
+      }
+    }
+
+    // Clip to [0, kQA], then multiply and add adjacent pairs into 32 bit lanes.
+    inline int32_t dotClippedAvx2(const int16_t* values, const int16_t* weights) {
+      const __m256i zero = _mm256_setzero_si256();
+      const __m256i ceiling = _mm256_set1_epi16(static_cast<int16_t>(kQA));
+      __m256i sum = _mm256_setzero_si256();
+      for (size_t i = 0; i < kHiddenSize; i += 16) {
+        __m256i value = _mm256_load_si256(reinterpret_cast<const __m256i*>(values + i));
+        value = _mm256_min_epi16(_mm256_max_epi16(value, zero), ceiling);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(value, _mm256_load_si256(reinterpret_cast<const __m256i*>(weights + i))));
+      }
+      __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+      half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+      half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+      return _mm_cvtsi128_si32(half);
+    }
+#endif
+
+    template <size_t addCount, size_t subCount>
+    inline void applyColumns(int16_t* out, const int16_t* in, const Columns<addCount, subCount> columns) {
+#ifdef __AVX2__
+      applyColumnsAvx2(out, in, columns);
+#else
+      applyColumnsScalar(out, in, columns);
+#endif
+    }
+
+    inline int32_t dotClipped(const int16_t* values, const int16_t* weights) {
+#ifdef __AVX2__
+      return dotClippedAvx2(values, weights);
+#else
+      return dotClippedScalar(values, weights);
+#endif
+    }
+
+    inline const int16_t* getColumn(const Network& network, size_t feature) {
+      return network.featureWeights.data() + feature * kHiddenSize;
+    }
+  }
+
+  // Rebuild both perspectives from the bias and every piece on the board, one column at a time.
+  inline void refresh(const Network& network, const BoardState& state, Accumulator& accumulator) {
+    for (Color perspective : { kWhite, kBlack }) {
+      int16_t* values = accumulator.values[perspective].data();
+      std::copy(network.featureBias.begin(), network.featureBias.end(), values);
+      for (Color color : { kWhite, kBlack }) {
+        for (Piece piece = kPawn; piece < kNoPiece; ++piece) {
+          for (Bitboard bb = state.bitboards_[color][piece]; bb; bb = popPiece(bb)) {
+            const int16_t* column = internal::getColumn(network, getFeatureIndex(perspective, color, piece, peekPiece(bb)));
+            internal::applyColumns<1, 0>(values, values, { { column }, {} });
+          }
+        }
+      }
+    }
+  }
+
+  // Compute the child accumulator from the parent one and the move, read from the parent state before it is made.
+  // A quiet move or promotion swaps one feature, a capture also removes one, castling swaps two.
+  inline void update(const Network& network, const Accumulator& parent, Accumulator& child, const BoardState& state, PackedMove move) {
+    const Color our = state.getColor();
+    const Color their = (our == kWhite ? kBlack : kWhite);
+    const Square srce = move.getSrce();
+    const Square dest = move.getDest();
+    const Piece piece = state.getPieceAt(our, srce);
+    const Piece placed = (move.isPromotion() ? move.getPromotionPiece() : piece);
+    const uint16_t flag = move.getFlag();
+
+    for (Color perspective : { kWhite, kBlack }) {
+      const auto column = [&](Color color, Piece columnPiece, Square square) {
+        return internal::getColumn(network, getFeatureIndex(perspective, color, columnPiece, square));
+      };
+      int16_t* out = child.values[perspective].data();
+      const int16_t* in = parent.values[perspective].data();
+
+      if (flag == PackedMove::kKingSideCastle || flag == PackedMove::kQueenSideCastle) {
+        const bool isKingSide = flag == PackedMove::kKingSideCastle;
+        const Square rookSrce = (our == kWhite ? (isKingSide ? H1 : A1) : (isKingSide ? H8 : A8));
+        const Square rookDest = (our == kWhite ? (isKingSide ? F1 : D1) : (isKingSide ? F8 : D8));
+        internal::applyColumns<2, 2>(out, in, { { column(our, kKing, dest), column(our, kRook, rookDest) },
+                                                { column(our, kKing, srce), column(our, kRook, rookSrce) } });
+      } else if (flag == PackedMove::kEnpassant) {
+        const Square capturedSq = (our == kWhite ? squareDown(dest) : squareUp(dest));
+        internal::applyColumns<1, 2>(out, in, { { column(our, kPawn, dest) }, { column(our, kPawn, srce), column(their, kPawn, capturedSq) } });
+      } else if (const Piece captured = state.getPieceAt(their, dest); captured != kNoPiece) {
+        internal::applyColumns<1, 2>(out, in, { { column(our, placed, dest) }, { column(our, piece, srce), column(their, captured, dest) } });
+      } else {
+        internal::applyColumns<1, 1>(out, in, { { column(our, placed, dest) }, { column(our, piece, srce) } });
+      }
+    }
+  }
+
+  // Centipawns from the side to move's point of view.
+  [[nodiscard]] inline int32_t evaluate(const Network& network, const Accumulator& accumulator, Color color) {
+    const Color other = (color == kWhite ? kBlack : kWhite);
+    const int32_t sum = internal::dotClipped(accumulator.values[color].data(), network.outputWeights.data()) +
+                        internal::dotClipped(accumulator.values[other].data(), network.outputWeights.data() + kHiddenSize);
+    return (sum + network.outputBias) * kScale / (kQA * kQB);
+  }
+}
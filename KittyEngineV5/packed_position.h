@@ -0,0 +1,182 @@
+#pragma once
+#include "board.h"
+#include "mapped_file.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+
+///////////////////////////////////////////////////////
+//                 PACKED POSITION
+///////////////////////////////////////////////////////
+// A 32 byte position record for datasets. A file of positions is the records back to back, as little endian
+// memory images, so it can be mapped, read in place and split between threads by byte range.
+namespace packed {
+  struct PackedPosition {
+    Bitboard occupancy;
+    std::array<uint64_t, 2> pieces;  // The mailbox cell of each occupied square in square order, 4 bits each.
+    uint8_t flags;                   // The castle permission squares in kCastleSquares order, black to move in the top bit.
+    uint8_t enpassant;               // A square or NO_SQUARE.
+    uint16_t halfmove;               // The counters are clamped to 65535.
+    uint16_t fullmove;
+    uint16_t reserved;               // Always 0.
+
+    constexpr bool operator==(const PackedPosition&) const = default;
+  };
+  static_assert(sizeof(PackedPosition) == 32 && std::is_trivially_copyable_v<PackedPosition>, "PackedPosition is not a 32 byte record");
+
+  inline constexpr size_t kMaxPieceCount = 32;
+  inline constexpr uint8_t kBlackToMoveFlag = 0x80;
+
+  // Castle permission is a bitboard of these squares, see kKingCastlePermission.
+  inline constexpr std::array<Square, 6> kCastleSquares = { E1, H1, A1, E8, H8, A8 };
+
+  // The mailbox cells that hold a piece, as a bit mask over the 16 nibble values.
+  inline constexpr uint32_t kPieceCellMask = 0x3F3F;
+
+  // Return false if the state has more than kMaxPieceCount pieces.
+  inline bool pack(const BoardState& state, PackedPosition& position) {
+    const Bitboard occupancy = state.getOccupancy(kWhite) | state.getOccupancy(kBlack);
+    if (countPiece(occupancy) > kMaxPieceCount) {
+      return false;
+    }
+
+    position.occupancy = occupancy;
+    position.pieces = {};
+    uint32_t i = 0;
+    for (Bitboard bb = occupancy; bb; bb = popPiece(bb), ++i) {
+      position.pieces[i / 16] |= static_cast<uint64_t>(state.mailbox_[peekPiece(bb)]) << (i % 16 * 4);
+    }
+
+    uint8_t flags = (state.getColor() == kBlack ? kBlackToMoveFlag : 0);
+    for (uint32_t j = 0; j < kCastleSquares.size(); ++j) {
+      flags |= static_cast<uint8_t>((state.castlePermission_ >> kCastleSquares[j] & 1) << j);
+    }
+    position.flags = flags;
+    position.enpassant = static_cast<uint8_t>(state.enpassant_);
+    position.halfmove = static_cast<uint16_t>(std::min<uint32_t>(state.halfmove_, UINT16_MAX));
+    position.fullmove = static_cast<uint16_t>(std::min<uint32_t>(state.fullmove_, UINT16_MAX));
+    position.reserved = 0;
+    return true;
+  }
+
+  // Return false if the record does not hold a position parseFEN would accept. The state is only written if it does.
+  inline bool unpack(const PackedPosition& position, BoardState& state) {
+    if (countPiece(position.occupancy) > kMaxPieceCount) {
+      return false;
+    }
+
+    BoardState boardState{};
+    boardState.mailbox_.fill(BoardState::kEmptyCell);
+    uint32_t i = 0;
+    for (Bitboard bb = position.occupancy; bb; bb = popPiece(bb), ++i) {
+      const uint8_t cell = position.pieces[i / 16] >> (i % 16 * 4) & 15;
+      if (!(kPieceCellMask >> cell & 1)) {
+        return false;
+      }
+      const Color color = cell >> 3;
+      const Piece piece = cell & 7;
+      const Square square = peekPiece(bb);
+      boardState.bitboards_[color][piece] = setSquare(boardState.bitboards_[color][piece], square);
+      boardState.mailbox_[square] = cell;
+      boardState.key_ ^= getPieceKey(color, piece, square);
+      boardState.psqt_ += getPsqtScore(color, piece, square);
+      boardState.phase_ += getPhaseWeight(piece);
+    }
+    if (countPiece(boardState.bitboards_[kWhite][kKing]) != 1 || countPiece(boardState.bitboards_[kBlack][kKing]) != 1 ||
+        ((boardState.bitboards_[kWhite][kPawn] | boardState.bitboards_[kBlack][kPawn]) & (kRank1Mask | kRank8Mask))) {
+      return false;
+    }
+
+    boardState.color_ = (position.flags & kBlackToMoveFlag ? kBlack : kWhite);
+    for (uint32_t j = 0; j < kCastleSquares.size(); ++j) {
+      boardState.castlePermission_ |= static_cast<Bitboard>(position.flags >> j & 1) << kCastleSquares[j];
+    }
+    const Bitboard enpassantRank = (boardState.color_ == kWhite ? kRank6Mask : kRank3Mask);
+    if (position.enpassant != NO_SQUARE && (position.enpassant > NO_SQUARE || !isSquareSet(enpassantRank, position.enpassant))) {
+      return false;
+    }
+    boardState.enpassant_ = position.enpassant;
+    boardState.halfmove_ = position.halfmove;
+    boardState.fullmove_ = position.fullmove;
+    boardState.key_ ^= getCastleKey(boardState.castlePermission_) ^ getEnpassantKey(boardState.enpassant_) ^
+                       (boardState.color_ == kBlack ? getSideKey() : 0);
+    state = boardState;
+    return true;
+  }
+
+  // Append records to a file through the stream's buffer.
+  class PositionWriter {
+    std::ofstream file_;
+    uint64_t count_;
+
+  public:
+    explicit PositionWriter(const std::string& path, bool isAppend = false)
+      : file_(path, std::ios::binary | (isAppend ? std::ios::app : std::ios::trunc)), count_(0) {
+    }
+
+    bool isOpen() const {
+      return file_.is_open();
+    }
+
+    // Return false if the state can not be packed or the write failed.
+    bool write(const BoardState& state) {
+      PackedPosition position;
+      if (!pack(state, position)) {
+        return false;
+      }
+      file_.write(reinterpret_cast<const char*>(&position), sizeof(position));
+      count_ += static_cast<bool>(file_);
+      return static_cast<bool>(file_);
+    }
+
+    bool flush() {
+      return static_cast<bool>(file_.flush());
+    }
+
+    uint64_t getCount() const {
+      return count_;
+    }
+  };
+
+  // A read only mapping of a position file. The records are read in place, a partial record at the end is left out.
+  class MappedPositionFile {
+    std::unique_ptr<MappedFile> file_;
+
+    explicit MappedPositionFile(std::unique_ptr<MappedFile> file) : file_(std::move(file)) {
+    }
+
+  public:
+    // Return nullptr if the file can not be opened or mapped.
+    static std::unique_ptr<MappedPositionFile> open(const std::string& path) {
+      std::unique_ptr<MappedFile> file = MappedFile::open(path, MappedFile::kSequentialAccess);
+      return (file ? std::unique_ptr<MappedPositionFile>(new MappedPositionFile(std::move(file))) : nullptr);
+    }
+
+    size_t size() const {
+      return file_->size() / sizeof(PackedPosition);
+    }
+
+    std::span<const PackedPosition> getRecords() const {
+      return { reinterpret_cast<const PackedPosition*>(file_->getData()), size() };
+    }
+
+    // The records that start in the byte range [begin, end). Cutting the file at any byte offsets
+    // gives every record to exactly one range, so threads can split it without knowing the record size.
+    std::span<const PackedPosition> getByteRange(uint64_t begin, uint64_t end) const {
+      const auto toRecord = [this](uint64_t offset) {
+        return std::min<uint64_t>((std::min<uint64_t>(offset, file_->size()) + sizeof(PackedPosition) - 1) / sizeof(PackedPosition), size());
+      };
+      const uint64_t first = toRecord(begin);
+      return getRecords().subspan(first, std::max(toRecord(end), first) - first);
+    }
+
+    uint64_t getByteSize() const {
+      return file_->size();
+    }
+  };
+}
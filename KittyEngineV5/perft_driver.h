@@ -1,13 +1,23 @@
 #pragma once
 #include "board.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
 #include <chrono>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
 
 namespace perft {
   struct Config {
     bool isParallel;
     bool isBulkCount;
     bool isDetailed;
+    bool isHashed = false;
+    bool isMakeUnmake = false;  // Make and unmake one state in place, instead of copy-make into a per ply stack.
   };
 
   struct Result {
@@ -16,133 +26,348 @@ namespace perft {
     uint64_t enpassants;
     uint64_t castles;
     uint64_t promotions;
+    uint64_t checks;
+    uint64_t discoveryChecks;
+    uint64_t doubleChecks;
+    uint64_t checkmates;
+
+    constexpr Result& operator+=(const Result& other) {
+      nodes += other.nodes;
+      captures += other.captures;
+      enpassants += other.enpassants;
+      castles += other.castles;
+      promotions += other.promotions;
+      checks += other.checks;
+      discoveryChecks += other.discoveryChecks;
+      doubleChecks += other.doubleChecks;
+      checkmates += other.checkmates;
+      return *this;
+    }
   };
 
+  // A fixed size cache of subtree node counts keyed by (zobrist key, depth), shared lock free between threads.
+  // Each entry stores key ^ data next to data, so a torn write fails validation instead of returning a wrong count.
+  class HashTable {
+    struct Entry {
+      std::atomic<uint64_t> check;
+      std::atomic<uint64_t> data;  // nodes << 8 | depth
+
+      bool probe(uint64_t key, uint64_t depth, uint64_t& nodes) const {
+        const uint64_t entryData = data.load(std::memory_order_relaxed);
+        if ((check.load(std::memory_order_relaxed) ^ entryData) == key && (entryData & 0xff) == depth) {
+          nodes = entryData >> 8;
+          return true;
+        }
+        return false;
+      }
+
+      void store(uint64_t key, uint64_t entryData) {
+        check.store(key ^ entryData, std::memory_order_relaxed);
+        data.store(entryData, std::memory_order_relaxed);
+      }
+
+      uint64_t getDepth() const {
+        return data.load(std::memory_order_relaxed) & 0xff;
+      }
+    };
+
+    // Depth preferred slot keeps the expensive subtrees, the other slot always takes the latest one.
+    struct alignas(32) Bucket {
+      Entry deep;
+      Entry recent;
+    };
+
+    std::unique_ptr<Bucket[]> buckets_;
+    size_t mask_;
+
+  public:
+    explicit HashTable(size_t megabytes) : buckets_(), mask_(0) {
+      // Round down to a power of two bucket count within the budget.
+      const size_t bucketCount = std::bit_floor(std::max<size_t>(megabytes * 1024 * 1024 / sizeof(Bucket), 1));
+      buckets_ = std::make_unique<Bucket[]>(bucketCount);  // Value initialised, so every entry starts empty.
+      mask_ = bucketCount - 1;
+    }
+
+    void clear() {
+      for (size_t i = 0; i <= mask_; ++i) {
+        buckets_[i].deep.store(0, 0);
+        buckets_[i].recent.store(0, 0);
+      }
+    }
+
+    bool probe(uint64_t key, uint32_t depth, uint64_t& nodes) const {
+      const Bucket& bucket = buckets_[key & mask_];
+      return bucket.deep.probe(key, depth, nodes) || bucket.recent.probe(key, depth, nodes);
+    }
+
+    void store(uint64_t key, uint32_t depth, uint64_t nodes) {
+      Bucket& bucket = buckets_[key & mask_];
+      const uint64_t entryData = nodes << 8 | depth;
+      if (depth >= bucket.deep.getDepth()) {
+        bucket.deep.store(key, entryData);
+      } else {
+        bucket.recent.store(key, entryData);
+      }
+    }
+  };
+
+  inline constexpr size_t kDefaultHashMegabytes = 256;
+
   namespace internal {
-    inline Result result{};
+    // Count the legal moves without making them.
+    struct MoveCounter {
+      static constexpr bool kIsBulkCount = true;
+      uint32_t count;
+
+      constexpr void acceptMoveCount(uint32_t moveCount) {
+        count += moveCount;
+      }
+    };
+
+    // Classify a leaf move for detailed perft. Flags known from the move type are resolved at compile time.
+    template <MoveType moveType>
+    inline constexpr void countDetails(const BoardState& state, Move<moveType> move, Result& result) {
+      constexpr Color our = moveType.color;
+      constexpr Color their = getOtherColor(our);
+
+      if constexpr (moveType.isEnpassant) {
+        ++result.captures;
+        ++result.enpassants;
+      } else if (state.getPieceAt(their, move.dest) != kNoPiece) {
+        ++result.captures;
+      }
+      if constexpr (moveType.isKingSideCastle || moveType.isQueenSideCastle) {
+        ++result.castles;
+      }
+      if constexpr (moveType.promotionPiece) {
+        ++result.promotions;
+      }
+
+      BoardState child = state;
+      child.makeMove(move);
+      const Square kingSq = peekPiece(child.bitboards_[their][kKing]);
+      const Bitboard checkers = child.getCheckers<their>(kingSq, child.getOccupancy(kWhite) | child.getOccupancy(kBlack));
+      if (checkers) {
+        ++result.checks;
+        // A castle can only give a direct check with its rook, the king lands on dest.
+        Square checkerSq = move.dest;
+        if constexpr (moveType.isKingSideCastle) {
+          checkerSq = (our == kWhite ? F1 : F8);
+        } else if constexpr (moveType.isQueenSideCastle) {
+          checkerSq = (our == kWhite ? D1 : D8);
+        }
+
+        // A double check is not counted as a discovery check as well.
+        if (popPiece(checkers)) {
+          ++result.doubleChecks;
+        } else if (checkers != toBitboard(checkerSq)) {
+          ++result.discoveryChecks;
+        }
+
+        MoveCounter counter{};
+        child.enumerateMoves<their>(counter);
+        if (counter.count == 0) {
+          ++result.checkmates;
+        }
+      }
+    }
   }
 
-  template <size_t depth>
+  template <Config config, size_t depth>
   class PerftDriver {
+    Result& result_;
+    HashTable* hashTable_;
+    const std::atomic<bool>* stopFlag_;  // Optional, the subtrees left once it is set are skipped.
+
+    // Copy-make writes the children into this slot, and the grandchildren into the next.
+    // Make-unmake keeps the one mutable state that is being enumerated here.
+    PlyState* stack_;
+
+    template <Color their>
+    constexpr void countChild(const BoardState& child, PlyState* stack) {
+      PerftDriver<config, depth - 1> driver(result_, hashTable_, stopFlag_, stack);
+
+      // Subtrees of depth 1 are cheaper to count than to look up.
+      if constexpr (config.isHashed && depth > 2) {
+        uint64_t nodes;
+        if (hashTable_->probe(child.key_, depth - 1, nodes)) {
+          result_.nodes += nodes;
+        } else {
+          nodes = result_.nodes;
+          child.enumerateMoves<their>(driver);
+          // A stopped subtree is only partly counted.
+          if (!stopFlag_ || !stopFlag_->load(std::memory_order_relaxed)) {
+            hashTable_->store(child.key_, depth - 1, result_.nodes - nodes);
+          }
+        }
+      } else {
+        child.enumerateMoves<their>(driver);
+      }
+    }
+
   public:
+    // At the last ply only the number of legal moves matters, so skip making them.
+    static constexpr bool kIsBulkCount = config.isBulkCount && depth <= 1;
+
+    constexpr PerftDriver(Result& result, HashTable* hashTable, const std::atomic<bool>* stopFlag, PlyState* stack)
+      : result_(result), hashTable_(hashTable), stopFlag_(stopFlag), stack_(stack) {}
+
+    constexpr void acceptMoveCount(uint32_t count) {
+      result_.nodes += count;
+    }
+
     template <MoveType moveType>
-    static constexpr void acceptMove(BoardState state, Move<moveType> move) {
+    constexpr void acceptMove(const BoardState& state, Move<moveType> move) {
+      // Only checked above the last two plies, where a subtree is still worth skipping.
+      if constexpr (depth > 2) {
+        if (stopFlag_ && stopFlag_->load(std::memory_order_relaxed)) {
+          return;
+        }
+      }
       if constexpr (depth <= 1) {
-        ++internal::result.nodes;
-      } else {
-        constexpr Color our = moveType.color;
-        constexpr Color their = getOtherColor(our);
-        const Square srce = move.srce;
-        const Square dest = move.dest;
-
-        // Move the square.
-        state.bitboards_[our][moveType.movedPiece] = moveSquare(state.bitboards_[our][moveType.movedPiece], srce, dest);
-        state.bitboards_[their][kPawn] = unsetSquare(state.bitboards_[their][kPawn], dest);
-        state.bitboards_[their][kKnight] = unsetSquare(state.bitboards_[their][kKnight], dest);
-        state.bitboards_[their][kBishop] = unsetSquare(state.bitboards_[their][kBishop], dest);
-        state.bitboards_[their][kRook] = unsetSquare(state.bitboards_[their][kRook], dest);
-        state.bitboards_[their][kQueen] = unsetSquare(state.bitboards_[their][kQueen], dest);
-
-        // Reset enpassant square
-        const Square enpassantSq = state.enpassant_;
-        if constexpr (!moveType.isDoublePush && !moveType.isEnpassant) {
-          state.enpassant_ = NO_SQUARE;
+        ++result_.nodes;
+        if constexpr (config.isDetailed) {
+          internal::countDetails(state, move, result_);
         }
+      } else if constexpr (config.isMakeUnmake) {
+        // The enumerating state lives in the stack slot, so it is safe to mutate as long as it is restored.
+        BoardState& board = stack_->state;
+        UndoRecord undo;
+        board.makeMove(move, undo);
+        countChild<getOtherColor(moveType.color)>(board, stack_);
+        board.unmakeMove(move, undo);
+      } else {
+        BoardState& child = stack_->state;
+        child = state;
+        child.makeMove(move);
+        countChild<getOtherColor(moveType.color)>(child, stack_ + 1);
+      }
+    }
+  };
+
+  namespace internal {
+    // Collect the child positions instead of recursing, used to split the tree across threads.
+    class FrontierCollector {
+      std::vector<BoardState>& frontier_;
 
-        // Update castle occupancy.
-        state.castlePermission_ = unsetSquare(unsetSquare(state.castlePermission_, srce), dest);
+    public:
+      explicit FrontierCollector(std::vector<BoardState>& frontier) : frontier_(frontier) {}
 
-        // Update half move and full move.
-        ++state.halfmove_;
-        /*if (move.isCaptured()) {
-          state.halfmove_ = 0;
-        }*/
+      template <MoveType moveType>
+      void acceptMove(BoardState state, Move<moveType> move) {
+        state.makeMove(move);
+        frontier_.push_back(state);
+      }
+    };
+
+    template <Config config, size_t depth>
+    inline void countNodes(const BoardState& state, Result& result, HashTable* hashTable, const std::atomic<bool>* stopFlag) {
+      std::array<PlyState, depth + 1> stack;
+      BoardState& root = stack[0].state;
+      root = state;
+      PerftDriver<config, depth> driver(result, hashTable, stopFlag, (config.isMakeUnmake ? &stack[0] : &stack[1]));
+      root.getColor() == kWhite ? root.enumerateMoves<kWhite>(driver) : root.enumerateMoves<kBlack>(driver);
+    }
 
-        if constexpr (our == kBlack) {
-          ++state.fullmove_;
+    template <Config config>
+    inline void countNodes(const BoardState& state, uint32_t depth, Result& result, HashTable* hashTable, const std::atomic<bool>* stopFlag) {
+      switch (depth) {
+      case 1: countNodes<config, 1>(state, result, hashTable, stopFlag); break;
+      case 2: countNodes<config, 2>(state, result, hashTable, stopFlag); break;
+      case 3: countNodes<config, 3>(state, result, hashTable, stopFlag); break;
+      case 4: countNodes<config, 4>(state, result, hashTable, stopFlag); break;
+      case 5: countNodes<config, 5>(state, result, hashTable, stopFlag); break;
+      case 6: countNodes<config, 6>(state, result, hashTable, stopFlag); break;
+      case 7: countNodes<config, 7>(state, result, hashTable, stopFlag); break;
+      case 8: countNodes<config, 8>(state, result, hashTable, stopFlag); break;
+      case 9: countNodes<config, 9>(state, result, hashTable, stopFlag); break;
+      case 10: countNodes<config, 10>(state, result, hashTable, stopFlag); break;
+      case 11: countNodes<config, 11>(state, result, hashTable, stopFlag); break;
+      case 12: countNodes<config, 12>(state, result, hashTable, stopFlag); break;
+      case 13: countNodes<config, 13>(state, result, hashTable, stopFlag); break;
+      case 14: countNodes<config, 14>(state, result, hashTable, stopFlag); break;
+      case 15: countNodes<config, 15>(state, result, hashTable, stopFlag); break;
+      default: break;
+      }
+    }
+
+    template <Config config>
+    inline void countNodesParallel(const BoardState& state, uint32_t depth, uint32_t threadCount, Result& result, HashTable* hashTable,
+                                   const std::atomic<bool>* stopFlag) {
+      // Expand a shallow frontier until every thread has several subtrees to balance the load.
+      constexpr size_t kTasksPerThread = 8;
+      std::vector<BoardState> frontier = { state };
+      for (; depth > 2 && frontier.size() < threadCount * kTasksPerThread; --depth) {
+        std::vector<BoardState> children;
+        FrontierCollector collector(children);
+        for (const BoardState& parent : frontier) {
+          parent.getColor() == kWhite ? parent.enumerateMoves<kWhite>(collector) : parent.enumerateMoves<kBlack>(collector);
         }
+        frontier = std::move(children);
+      }
 
-        if constexpr (moveType.movedPiece == kPawn) {
-          state.halfmove_ = 0;
-
-          if constexpr (moveType.isEnpassant) {
-            if constexpr (their == kWhite) {
-              state.bitboards_[their][kPawn] = unsetSquare(state.bitboards_[their][kPawn], squareUp(enpassantSq));
-            } else {
-              state.bitboards_[their][kPawn] = unsetSquare(state.bitboards_[their][kPawn], squareDown(enpassantSq));
-            }
-          } else if constexpr (moveType.isDoublePush) {
-            if constexpr (our == kWhite) {
-              state.enpassant_ = squareUp(srce);
-            } else {
-              state.enpassant_ = squareDown(srce);
-            }
-          } else if constexpr (moveType.promotionPiece) {
-            state.bitboards_[our][kPawn] = unsetSquare(state.bitboards_[our][kPawn], dest);
-            state.bitboards_[our][moveType.promotionPiece] = setSquare(state.bitboards_[our][moveType.promotionPiece], dest);
-          }
+      // One result slot per worker, padded to avoid false sharing. Merged after the pool drains.
+      struct alignas(64) ThreadResult {
+        Result result;
+      };
+      std::vector<ThreadResult> threadResults(threadCount);
 
-        } else if constexpr (moveType.movedPiece == kKing) {
-          if constexpr (moveType.isKingSideCastle) {
-            if constexpr (our == kWhite) {
-              state.bitboards_[our][kRook] = moveSquare(state.bitboards_[our][kRook], H1, F1);
-            } else {
-              state.bitboards_[our][kRook] = moveSquare(state.bitboards_[our][kRook], H8, F8);
-            }
-          } else if constexpr (moveType.isQueenSideCastle) {
-            if constexpr (our == kWhite) {
-              state.bitboards_[our][kRook] = moveSquare(state.bitboards_[our][kRook], A1, D1);
-            } else {
-              state.bitboards_[our][kRook] = moveSquare(state.bitboards_[our][kRook], A8, D8);
-            }
+      ThreadPool pool(threadCount);
+      for (const BoardState& child : frontier) {
+        pool.submit([&threadResults, &child, depth, hashTable, stopFlag](size_t workerId) {
+          if (stopFlag && stopFlag->load(std::memory_order_relaxed)) {
+            return;
           }
-        }
+          Result subtree{};
+          countNodes<config>(child, depth, subtree, hashTable, stopFlag);
+          threadResults[workerId].result += subtree;
+        });
+      }
+      pool.wait();
 
-        state.color_ = getOtherColor(our);
-        state.enumerateMoves<their, PerftDriver<depth-1>>();
+      for (const ThreadResult& threadResult : threadResults) {
+        result += threadResult.result;
       }
     }
+  }
 
-  };
+  inline uint32_t getDefaultThreadCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
 
+  // Hashed configs need a caller owned table, which may be kept between calls. Once the stop flag is set
+  // the count returns early, with only the subtrees it finished.
   template <Config config, bool canPrint = true>
-  inline constexpr Result runPerft(const BoardState& state, uint32_t depth) {
+  inline Result runPerft(const BoardState& state, uint32_t depth, uint32_t threadCount = getDefaultThreadCount(), HashTable* hashTable = nullptr,
+                         const std::atomic<bool>* stopFlag = nullptr) {
     static_assert(!(config.isBulkCount && config.isDetailed), "bulk counting is incompatiable with detailed perft");
+    static_assert(!(config.isHashed && config.isDetailed), "hashed perft only caches node counts");
     using namespace std::chrono;
 
-    internal::result = Result{};
+    assert((!config.isHashed || hashTable) && "hashed perft needs a table");
+
+    Result result{};
 
     auto start = high_resolution_clock::now();
-    switch (depth) {
-    case 1: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<1>>() : state.enumerateMoves<kBlack, PerftDriver<1>>(); break;
-    case 2: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<2>>() : state.enumerateMoves<kBlack, PerftDriver<2>>(); break;
-    case 3: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<3>>() : state.enumerateMoves<kBlack, PerftDriver<3>>(); break;
-    case 4: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<4>>() : state.enumerateMoves<kBlack, PerftDriver<4>>(); break;
-    case 5: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<5>>() : state.enumerateMoves<kBlack, PerftDriver<5>>(); break;
-    case 6: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<6>>() : state.enumerateMoves<kBlack, PerftDriver<6>>(); break;
-    case 7: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<7>>() : state.enumerateMoves<kBlack, PerftDriver<7>>(); break;
-    case 8: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<8>>() : state.enumerateMoves<kBlack, PerftDriver<8>>(); break;
-    case 9: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<9>>() : state.enumerateMoves<kBlack, PerftDriver<9>>(); break;
-    case 10: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<10>>() : state.enumerateMoves<kBlack, PerftDriver<10>>(); break;
-    case 11: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<11>>() : state.enumerateMoves<kBlack, PerftDriver<11>>(); break;
-    case 12: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<12>>() : state.enumerateMoves<kBlack, PerftDriver<12>>(); break;
-    case 13: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<13>>() : state.enumerateMoves<kBlack, PerftDriver<13>>(); break;
-    case 14: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<14>>() : state.enumerateMoves<kBlack, PerftDriver<14>>(); break;
-    case 15: state.getColor() == kWhite ? state.enumerateMoves<kWhite, PerftDriver<15>>() : state.enumerateMoves<kBlack, PerftDriver<15>>(); break;
-    default: break;
+    if (config.isParallel && threadCount > 1 && depth > 2) {
+      internal::countNodesParallel<config>(state, depth, threadCount, result, hashTable, stopFlag);
+    } else {
+      internal::countNodes<config>(state, depth, result, hashTable, stopFlag);
     }
     auto end = high_resolution_clock::now();
 
     if constexpr (canPrint) {
       auto ms = duration_cast<milliseconds>(end - start);
-      uint64_t knps = (ms.count() > 0 ? static_cast<uint64_t>(static_cast<double>(internal::result.nodes) / ms.count()) : internal::result.nodes);
-      std::cout << std::format("depth {}, nodes {}, time {}, speed {} knps\n", depth, internal::result.nodes, ms, knps);
+      uint64_t knps = (ms.count() > 0 ? static_cast<uint64_t>(static_cast<double>(result.nodes) / ms.count()) : result.nodes);
+      std::cout << std::format("depth {}, nodes {}, time {}, speed {} knps\n", depth, result.nodes, ms, knps);
       if constexpr (config.isDetailed) {
-        std::cout << std::format("    captures {} enpassants {} castles {} promotions {}\n",
-                                 internal::result.captures, internal::result.enpassants, internal::result.castles, internal::result.promotions);
+        std::cout << std::format("    captures {} enpassants {} castles {} promotions {}\n"
+                                 "    checks {} discovery checks {} double checks {} checkmates {}\n",
+                                 result.captures, result.enpassants, result.castles, result.promotions,
+                                 result.checks, result.discoveryChecks, result.doubleChecks, result.checkmates);
       }
     }
 
-    return internal::result;
+    return result;
   }
 }
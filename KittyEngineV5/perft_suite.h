@@ -0,0 +1,224 @@
+#pragma once
+#include "board.h"
+#include "move_list.h"
+#include "perft_driver.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <format>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+///////////////////////////////////////////////////////
+//                 EPD PERFT SUITE
+///////////////////////////////////////////////////////
+// Verify the move generator against a stream of EPD lines such as "fen ;D1 20 ;D2 400".
+// Lines are streamed into a bounded window of tasks, one position per task, and reported in line order.
+namespace perft {
+  struct SuiteResult {
+    uint64_t positions;
+    uint64_t failures;  // Positions with a malformed line or at least one wrong count.
+    uint64_t nodes;
+    std::chrono::milliseconds time;
+  };
+
+  namespace internal {
+    inline constexpr uint32_t kMaxSuiteDepth = 15;  // Deepest depth countNodes is instantiated for.
+
+    struct SuiteEntry {
+      uint64_t lineNumber;
+      bool isMalformed;
+      std::string fen;
+      BoardState state;
+      std::vector<std::pair<uint32_t, uint64_t>> expected;  // Depth, node count.
+    };
+
+    // What a task found, reported by the reading thread in line order.
+    struct SuiteOutcome {
+      uint64_t nodes;
+      uint32_t failedDepth;  // Zero if every depth matched.
+      uint64_t expectedNodes;
+      uint64_t actualNodes;
+      std::vector<std::pair<PackedMove, uint64_t>> divide;  // Node count under each root move at the failed depth.
+    };
+
+    inline std::string_view trim(std::string_view text) {
+      const size_t begin = text.find_first_not_of(" \t\r\n");
+      if (begin == std::string_view::npos) {
+        return {};
+      }
+      return text.substr(begin, text.find_last_not_of(" \t\r\n") - begin + 1);
+    }
+
+    // Return false if the fen is invalid or a field after it is not "D<depth> <nodes>". Depths beyond maxDepth are left out.
+    inline bool parseEpdLine(std::string_view line, uint32_t maxDepth, SuiteEntry& entry) {
+      size_t separator = line.find(';');
+      entry.fen = std::string(trim(line.substr(0, separator)));
+      entry.expected.clear();
+      while (separator != std::string_view::npos) {
+        line.remove_prefix(separator + 1);
+        separator = line.find(';');
+        const std::string field(trim(line.substr(0, separator)));
+        if (field.size() < 2 || field[0] != 'D') {
+          return false;
+        }
+        char* end = nullptr;
+        const unsigned long depth = std::strtoul(field.c_str() + 1, &end, 10);
+        if (end == field.c_str() + 1 || *end != ' ' || depth == 0) {
+          return false;
+        }
+        const char* countBegin = end;
+        const unsigned long long nodes = std::strtoull(countBegin, &end, 10);
+        if (end == countBegin || *end != '\0') {
+          return false;
+        }
+        if (depth <= maxDepth) {
+          entry.expected.emplace_back(static_cast<uint32_t>(depth), nodes);
+        }
+      }
+      return BoardState::parseFEN(entry.fen, entry.state) == kFenOk;
+    }
+
+    inline uint64_t countSingleThread(const BoardState& state, uint32_t depth, HashTable& hashTable) {
+      constexpr Config config{ false, true, false, true };
+      return runPerft<config, false>(state, depth, 1, &hashTable).nodes;
+    }
+
+    inline SuiteOutcome verifyEntry(const SuiteEntry& entry, HashTable& hashTable) {
+      const BoardState& state = entry.state;
+      SuiteOutcome outcome{};
+      for (const auto& [depth, expectedNodes] : entry.expected) {
+        const uint64_t nodes = countSingleThread(state, depth, hashTable);
+        outcome.nodes += nodes;
+        if (nodes != expectedNodes) {
+          outcome.failedDepth = depth;
+          outcome.expectedNodes = expectedNodes;
+          outcome.actualNodes = nodes;
+          for (PackedMove move : MoveList::fromState(state)) {
+            BoardState child = state;
+            child.makeMove(move);
+            outcome.divide.emplace_back(move, depth <= 1 ? 1 : countSingleThread(child, depth - 1, hashTable));
+          }
+          break;
+        }
+      }
+      return outcome;
+    }
+  }
+
+  // Check every count up to maxDepth, writing each failure with its divide and then the totals to out.
+  inline SuiteResult runSuite(std::istream& in, std::ostream& out, uint32_t maxDepth = internal::kMaxSuiteDepth,
+                              uint32_t threadCount = getDefaultThreadCount()) {
+    using namespace std::chrono;
+    using internal::SuiteEntry;
+    using internal::SuiteOutcome;
+
+    struct Slot {
+      SuiteEntry entry;
+      SuiteOutcome outcome;
+      bool isDone;
+    };
+
+    maxDepth = std::min(maxDepth, internal::kMaxSuiteDepth);
+    threadCount = std::max(threadCount, 1u);
+    const size_t maxRunning = static_cast<size_t>(threadCount) * 2;   // Keeps a line queued behind every worker.
+    const size_t maxBuffered = static_cast<size_t>(threadCount) * 64;  // Finished lines waiting behind a slow one.
+    HashTable hashTable(kDefaultHashMegabytes);  // Shared by every task, positions of a suite often share subtrees.
+    ThreadPool pool(threadCount);
+    SuiteResult result{};
+    auto start = steady_clock::now();
+
+    // Slots are reported from the front in line order. A deque keeps their addresses stable for the tasks.
+    std::deque<Slot> slots;
+    std::mutex mutex;
+    std::condition_variable doneCondition;
+    size_t running = 0;
+
+    auto report = [&](const Slot& slot) {
+      const SuiteEntry& entry = slot.entry;
+      const SuiteOutcome& outcome = slot.outcome;
+      ++result.positions;
+      result.nodes += outcome.nodes;
+      if (entry.isMalformed) {
+        ++result.failures;
+        out << std::format("line {}: malformed \"{}\"\n", entry.lineNumber, entry.fen);
+      } else if (outcome.failedDepth) {
+        ++result.failures;
+        out << std::format("line {}: depth {} expected {}, got {}, fen {}\n",
+                           entry.lineNumber, outcome.failedDepth, outcome.expectedNodes, outcome.actualNodes, entry.fen);
+        for (const auto& [move, nodes] : outcome.divide) {
+          out << std::format("    {}: {}\n", moveToString(move), nodes);
+        }
+      }
+    };
+
+    std::string line;
+    uint64_t lineNumber = 0;
+    bool isEnd = false;
+    std::unique_lock lock(mutex);
+    for (;;) {
+      while (!slots.empty() && slots.front().isDone) {
+        lock.unlock();
+        report(slots.front());
+        lock.lock();
+        slots.pop_front();
+      }
+
+      if (!isEnd && running < maxRunning && slots.size() < maxBuffered) {
+        // Submit the next line as soon as a task has finished, without waiting for the slower ones before it.
+        lock.unlock();
+        if (!std::getline(in, line)) {
+          isEnd = true;
+          lock.lock();
+          continue;
+        }
+        ++lineNumber;
+        if (const std::string_view text = internal::trim(line); text.empty() || text[0] == '#') {
+          lock.lock();
+          continue;
+        }
+        Slot& slot = slots.emplace_back(Slot{ SuiteEntry{ lineNumber, false, {}, {}, {} }, SuiteOutcome{}, false });
+        if (!internal::parseEpdLine(line, maxDepth, slot.entry)) {
+          slot.entry.isMalformed = true;
+          slot.entry.fen = line;
+        }
+        lock.lock();
+        if (slot.entry.isMalformed) {
+          slot.isDone = true;
+        } else {
+          ++running;
+          pool.submit([&, slotPtr = &slot](size_t) {
+            SuiteOutcome outcome = internal::verifyEntry(slotPtr->entry, hashTable);
+            std::lock_guard taskLock(mutex);
+            slotPtr->outcome = std::move(outcome);
+            slotPtr->isDone = true;
+            --running;
+            doneCondition.notify_one();
+          });
+        }
+        continue;
+      }
+
+      if (isEnd && slots.empty()) {
+        break;
+      }
+      doneCondition.wait(lock, [&]() {
+        return (!slots.empty() && slots.front().isDone) || (!isEnd && running < maxRunning && slots.size() < maxBuffered);
+      });
+    }
+    lock.unlock();
+
+    result.time = duration_cast<milliseconds>(steady_clock::now() - start);
+    const uint64_t knps = result.nodes / std::max<uint64_t>(result.time.count(), 1);
+    out << std::format("positions {}, failures {}, nodes {}, time {}, speed {} knps\n", result.positions, result.failures, result.nodes, result.time, knps);
+    return result;
+  }
+}
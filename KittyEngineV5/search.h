@@ -0,0 +1,576 @@
+#pragma once
+#include "bitbase.h"
+#include "board.h"
+#include "move_list.h"
+#include "move_picker.h"
+#include "nnue.h"
+#include "thread_pool.h"
+#include "transposition_table.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <span>
+#include <vector>
+
+///////////////////////////////////////////////////////
+//                 SEARCH
+///////////////////////////////////////////////////////
+namespace search {
+  using Score = int32_t;
+
+  inline constexpr uint32_t kMaxPly = 128;
+  inline constexpr Score kInfinity = 32000;
+  inline constexpr Score kMateScore = 31000;
+  inline constexpr Score kMateBound = kMateScore - static_cast<Score>(kMaxPly);  // Any score beyond it is a forced mate.
+  inline constexpr size_t kDefaultHashMegabytes = 16;
+  inline constexpr Score kDeltaMargin = 200;  // Positional slack a capture may still make up for in quiescence.
+  inline constexpr int32_t kBitbaseMaxPhase = 4;  // The phase of a lone queen, no bitbase position is above it.
+
+  // Zero means no limit. The search always finishes depth 1 so it has a move to return.
+  struct Limits {
+    uint32_t depth = kMaxPly - 1;
+    uint64_t nodes = 0;
+    std::chrono::milliseconds moveTime{ 0 };
+    std::span<const uint64_t> history;  // Keys of the game positions before the root, oldest first, for repetitions.
+  };
+
+  struct Result {
+    PackedMove bestMove;
+    Score score;
+    uint32_t depth;
+    uint64_t nodes;
+    uint64_t quiescenceNodes;  // Included in nodes.
+    uint64_t nps;
+    std::chrono::milliseconds time;
+    std::vector<PackedMove> pv;
+  };
+
+  [[nodiscard]] inline constexpr bool isMateScore(Score score) {
+    return score > kMateBound || score < -kMateBound;
+  }
+
+  // Mate scores are stored relative to the node instead of the root, so they stay valid at another ply.
+  [[nodiscard]] inline constexpr Score scoreToTT(Score score, uint32_t ply) {
+    return (score > kMateBound ? score + static_cast<Score>(ply) : score < -kMateBound ? score - static_cast<Score>(ply) : score);
+  }
+
+  [[nodiscard]] inline constexpr Score scoreFromTT(Score score, uint32_t ply) {
+    return (score > kMateBound ? score - static_cast<Score>(ply) : score < -kMateBound ? score + static_cast<Score>(ply) : score);
+  }
+
+  // Tapered piece square evaluation from the side to move's point of view, read from the incrementally updated state.
+  [[nodiscard]] inline constexpr Score evaluate(const BoardState& state) {
+    const int32_t phase = std::min(state.phase_, kMaxPhase);
+    const Score score = (state.psqt_.mg * phase + state.psqt_.eg * (kMaxPhase - phase)) / kMaxPhase;
+    return (state.getColor() == kWhite ? score : -score);
+  }
+
+  // Only the draws of the bitbases are used, a won ending is still searched so the search keeps making progress.
+  [[nodiscard]] inline bool isBitbaseDraw(const BoardState& state) {
+    return state.phase_ <= kBitbaseMaxPhase && bitbase::getTables().probe(state) == bitbase::kDrawResult;
+  }
+
+  // Material a capture or promotion wins if it is not recaptured.
+  [[nodiscard]] inline constexpr Score getCaptureGain(const BoardState& state, PackedMove move) {
+    const Piece victim = (move.getFlag() == PackedMove::kEnpassant ? kPawn : state.getPieceAt(move.getDest()));
+    return kSeeValues[victim] + (move.isPromotion() ? kSeeValues[move.getPromotionPiece()] - kSeeValues[kPawn] : 0);
+  }
+
+  // Principal variation search under iterative deepening. Each node copies the state, makes the move and recurses,
+  // the same copy make scheme as the perft driver. The moves come from a staged move picker, see MovePicker.
+  // The leaves run a quiescence search over the captures, so a line is never scored in the middle of an exchange.
+  // One searcher is the whole state of a search thread, aligned so two threads never share a cache line.
+  class alignas(64) Searcher {
+  public:
+    using IterationCallback = std::function<void(const Result&)>;
+
+  private:
+    static constexpr uint64_t kCheckInterval = 2048;
+
+    TranspositionTable& tt_;
+    uint32_t threadId_;
+    std::atomic<bool> isStopRequested_;
+    bool isStopped_;  // Hit the node or time limit.
+    Limits limits_;
+    std::chrono::steady_clock::time_point startTime_;
+    std::atomic<uint64_t> nodes_;  // Only written by the owner thread, read by the others for the total.
+    uint64_t quiescenceNodes_;
+    uint32_t rootDepth_;
+
+    // Triangular principal variation table, pv_[ply] holds the best line from that ply.
+    std::array<std::array<PackedMove, kMaxPly>, kMaxPly> pv_;
+    std::array<uint32_t, kMaxPly> pvLength_;
+    std::vector<PackedMove> previousPv_;
+
+    // Keys along the current line, for repetition detection.
+    std::array<uint64_t, kMaxPly> keys_;
+
+    // Copy-make slot per ply, the root is copied into the first one.
+    std::array<PlyState, kMaxPly + 1> stack_;
+    bool isMakeUnmake_;
+    bool isQuiescence_;
+
+    // The network evaluates the leaves when one is set, each ply's accumulator is updated from its parent as the move is made.
+    const nnue::Network* network_;
+    std::array<nnue::Accumulator, kMaxPly + 1> accumulators_;
+
+    HistoryTable history_;
+
+    // Two quiet moves per ply that caused a beta cutoff, and the quiet reply that refuted each move, indexed by its mover.
+    std::array<std::array<PackedMove, 2>, kMaxPly> killers_;
+    std::array<std::array<std::array<PackedMove, kSquareSize>, kSquareSize>, kColorSize> counterMoves_;
+    std::array<PackedMove, kMaxPly> playedMoves_;  // The move made at each ply of the current line.
+
+    void checkLimits() {
+      if (limits_.nodes && getNodes() >= limits_.nodes) {
+        isStopped_ = true;
+      }
+      if (limits_.moveTime.count() && std::chrono::steady_clock::now() - startTime_ >= limits_.moveTime) {
+        isStopped_ = true;
+      }
+    }
+
+    bool isStopping() const {
+      return isStopped_ || isStopRequested_.load(std::memory_order_relaxed);
+    }
+
+    // Depth 1 always runs to completion, so there is a move to fall back on.
+    bool isStopped() const {
+      return rootDepth_ > 1 && isStopping();
+    }
+
+    void countNode() {
+      const uint64_t nodes = getNodes() + 1;
+      nodes_.store(nodes, std::memory_order_relaxed);
+      if (nodes % kCheckInterval == 0) {
+        checkLimits();
+      }
+    }
+
+    bool isRepetition(const BoardState& state, uint32_t ply) const {
+      // Only positions with the same side to move since the last irreversible move can repeat.
+      // Beyond the root the keys come from the game history.
+      const std::span<const uint64_t> history = limits_.history;
+      const uint32_t reversible = std::min<uint32_t>(state.halfmove_, ply + static_cast<uint32_t>(history.size()));
+      for (uint32_t distance = 4; distance <= reversible; distance += 2) {
+        if ((distance <= ply ? keys_[ply - distance] : history[history.size() - (distance - ply)]) == state.key_) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    Score evaluate(const BoardState& state, uint32_t ply) const {
+      return (network_ ? nnue::evaluate(*network_, accumulators_[ply], state.getColor()) : search::evaluate(state));
+    }
+
+    // Remember a quiet move that caused a beta cutoff, for its ply, for the move it answered, and in the history.
+    template <Color our>
+    void updateQuietCutoff(PackedMove move, uint32_t depth, uint32_t ply) {
+      constexpr Color their = getOtherColor(our);
+      history_[our][move.getSrce()][move.getDest()] += static_cast<int32_t>(depth * depth);
+      if (killers_[ply][0] != move) {
+        killers_[ply][1] = killers_[ply][0];
+        killers_[ply][0] = move;
+      }
+      if (ply > 0) {
+        const PackedMove previous = playedMoves_[ply - 1];
+        counterMoves_[their][previous.getSrce()][previous.getDest()] = move;
+      }
+    }
+
+    // Make the move into the next ply, updating the accumulator from the parent first. Return the child state.
+    template <bool isMakeUnmake>
+    BoardState& makeMove(BoardState& state, PackedMove move, UndoRecord& undo, uint32_t ply) {
+      playedMoves_[ply] = move;
+      if (network_) {
+        nnue::update(*network_, accumulators_[ply], accumulators_[ply + 1], state, move);
+      }
+      BoardState* child = &state;
+      if constexpr (isMakeUnmake) {
+        state.makeMove(move, undo);
+      } else {
+        child = &stack_[ply + 1].state;
+        *child = state;
+        child->makeMove(move);
+      }
+      return *child;
+    }
+
+    // Search the captures until the position is quiet. The side to move may stand pat on the static evaluation,
+    // except in check, where every evasion is searched and no evasion is a mate.
+    // Captures that lose material, or that can not bring the evaluation back up to alpha, are pruned.
+    template <Color our, bool isMakeUnmake>
+    Score quiescence(BoardState& state, Score alpha, Score beta, uint32_t ply) {
+      pvLength_[ply] = 0;
+      keys_[ply] = state.key_;
+      countNode();
+      ++quiescenceNodes_;
+
+      if (state.halfmove_ >= 100 || isRepetition(state, ply) || isBitbaseDraw(state)) {
+        return 0;
+      }
+      if (ply >= kMaxPly - 1) {
+        return evaluate(state, ply);
+      }
+
+      const bool isInCheck = state.isInCheck<our>();
+      Score bestScore = -kInfinity;
+      if (!isInCheck) {
+        bestScore = evaluate(state, ply);
+        if (bestScore >= beta) {
+          return bestScore;
+        }
+        alpha = std::max(alpha, bestScore);
+      }
+
+      constexpr Color their = getOtherColor(our);
+      MovePicker<our> picker = (isInCheck ? MovePicker<our>(state, kNullMove, { kNullMove, kNullMove, kNullMove }, history_) : MovePicker<our>(state, history_));
+      const Score standPat = bestScore;
+      uint32_t moveCount = 0;
+      for (PackedMove move = picker.next(); !move.isNull(); move = picker.next()) {
+        ++moveCount;
+        if (!isInCheck && standPat + getCaptureGain(state, move) + kDeltaMargin <= alpha) {
+          continue;
+        }
+
+        UndoRecord undo;
+        BoardState& child = makeMove<isMakeUnmake>(state, move, undo, ply);
+        const Score score = -quiescence<their, isMakeUnmake>(child, -beta, -alpha, ply + 1);
+        if constexpr (isMakeUnmake) {
+          state.unmakeMove(move, undo);
+        }
+        if (isStopped()) {
+          return 0;
+        }
+
+        if (score > bestScore) {
+          bestScore = score;
+          if (score > alpha) {
+            alpha = score;
+            if (score >= beta) {
+              break;
+            }
+          }
+        }
+      }
+
+      if (isInCheck && moveCount == 0) {
+        return -kMateScore + static_cast<Score>(ply);
+      }
+      return bestScore;
+    }
+
+    // Copy-make writes the child into the next slot of the per ply stack, make-unmake mutates the state in place.
+    // isOnPreviousPv is set while every move from the root so far follows the previous iteration's principal variation.
+    template <Color our, bool isMakeUnmake>
+    Score negamax(BoardState& state, Score alpha, Score beta, uint32_t depth, uint32_t ply, bool isOnPreviousPv) {
+      if (depth == 0 && isQuiescence_) {
+        return quiescence<our, isMakeUnmake>(state, alpha, beta, ply);
+      }
+
+      const bool isPvNode = beta - alpha > 1;
+      pvLength_[ply] = 0;
+      keys_[ply] = state.key_;
+      countNode();
+
+      if (ply > 0 && (state.halfmove_ >= 100 || isRepetition(state, ply) || isBitbaseDraw(state))) {
+        return 0;
+      }
+      if (depth == 0 || ply >= kMaxPly - 1) {
+        return evaluate(state, ply);
+      }
+
+      // The principal variation is never cut by the table, so it is always complete.
+      TTData ttData{};
+      const bool isTTHit = tt_.probe(state.key_, ttData);
+      if (isTTHit && !isPvNode && ttData.depth >= depth) {
+        const Score ttScore = scoreFromTT(ttData.score, ply);
+        if (ttData.bound == kExactBound ||
+            (ttData.bound == kLowerBound && ttScore >= beta) ||
+            (ttData.bound == kUpperBound && ttScore <= alpha)) {
+          return ttScore;
+        }
+      }
+
+      // Hash move first, falling back to the previous principal variation while still on it.
+      // Helper threads break the history ties in another order, so they spread over different parts of the tree.
+      const PackedMove pvMove = (isOnPreviousPv && ply < previousPv_.size() ? previousPv_[ply] : kNullMove);
+      const PackedMove hashMove = (isTTHit && !ttData.move.isNull() ? ttData.move : pvMove);
+      constexpr Color their = getOtherColor(our);
+      const PackedMove previous = (ply > 0 ? playedMoves_[ply - 1] : kNullMove);
+      const PackedMove counterMove = (ply > 0 ? counterMoves_[their][previous.getSrce()][previous.getDest()] : kNullMove);
+      MovePicker<our> picker(state, hashMove, { killers_[ply][0], killers_[ply][1], counterMove }, history_, threadId_);
+
+      const Score originalAlpha = alpha;
+      Score bestScore = -kInfinity;
+      PackedMove bestMove = kNullMove;
+      uint32_t moveCount = 0;
+      for (PackedMove move = picker.next(); !move.isNull(); move = picker.next()) {
+        // Known before the move is made, the captured piece is gone afterwards.
+        const bool isQuiet = !state.isCaptureMove(move);
+        UndoRecord undo;
+        BoardState* const child = &makeMove<isMakeUnmake>(state, move, undo, ply);
+        tt_.prefetch(child->key_);
+        const bool isChildOnPreviousPv = !pvMove.isNull() && move == pvMove;
+
+        // Prove the later moves worse with a null window, and only search again if one is not.
+        Score score;
+        if (moveCount == 0) {
+          score = -negamax<their, isMakeUnmake>(*child, -beta, -alpha, depth - 1, ply + 1, isChildOnPreviousPv);
+        } else {
+          score = -negamax<their, isMakeUnmake>(*child, -alpha - 1, -alpha, depth - 1, ply + 1, isChildOnPreviousPv);
+          if (score > alpha && score < beta) {
+            score = -negamax<their, isMakeUnmake>(*child, -beta, -alpha, depth - 1, ply + 1, isChildOnPreviousPv);
+          }
+        }
+        ++moveCount;
+        if constexpr (isMakeUnmake) {
+          state.unmakeMove(move, undo);
+        }
+        if (isStopped()) {
+          return 0;
+        }
+
+        if (score > bestScore) {
+          bestScore = score;
+          if (score > alpha) {
+            alpha = score;
+            bestMove = move;
+            pv_[ply][0] = move;
+            std::copy_n(pv_[ply + 1].begin(), pvLength_[ply + 1], pv_[ply].begin() + 1);
+            pvLength_[ply] = pvLength_[ply + 1] + 1;
+            if (score >= beta) {
+              if (isQuiet) {
+                updateQuietCutoff<our>(move, depth, ply);
+              }
+              break;
+            }
+          }
+        }
+      }
+
+      if (moveCount == 0) {
+        return (state.isInCheck<our>() ? -kMateScore + static_cast<Score>(ply) : 0);
+      }
+
+      const Bound bound = (bestScore >= beta ? kLowerBound : bestScore > originalAlpha ? kExactBound : kUpperBound);
+      tt_.store(state.key_, bestMove, scoreToTT(bestScore, ply), depth, bound);
+      return bestScore;
+    }
+
+  public:
+    // The bitbases are generated here on first use, so no search is ever timed with the generation in it.
+    explicit Searcher(TranspositionTable& tt, uint32_t threadId = 0)
+      : tt_(tt), threadId_(threadId), isStopRequested_(false), isStopped_(false), limits_(), startTime_(), nodes_(0), quiescenceNodes_(0),
+        rootDepth_(0), pv_(), pvLength_(), previousPv_(), keys_(), stack_(), isMakeUnmake_(false), isQuiescence_(true), network_(nullptr),
+        accumulators_(), history_(), killers_(), counterMoves_(), playedMoves_() {
+      bitbase::getTables();
+    }
+
+    uint64_t getNodes() const {
+      return nodes_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getQuiescenceNodes() const {
+      return quiescenceNodes_;
+    }
+
+    // Score the leaves with the static evaluation instead of a quiescence search, to measure what it costs and saves.
+    void setQuiescence(bool isQuiescence) {
+      isQuiescence_ = isQuiescence;
+    }
+
+    // Choose between copy-make and make-unmake for the next searches.
+    void setMakeUnmake(bool isMakeUnmake) {
+      isMakeUnmake_ = isMakeUnmake;
+    }
+
+    // Evaluate with the network instead of the piece square tables, or go back to them with nullptr.
+    // The network must outlive the searches.
+    void setNetwork(const nnue::Network* network) {
+      network_ = network;
+    }
+
+    // Safe to call from another thread. The request holds until clearStop, so a stop sent
+    // just before the search thread starts is not lost.
+    void stop() {
+      isStopRequested_.store(true, std::memory_order_relaxed);
+    }
+
+    void clearStop() {
+      isStopRequested_.store(false, std::memory_order_relaxed);
+    }
+
+    Result search(const BoardState& state, const Limits& limits, const IterationCallback& onIteration = nullptr) {
+      using namespace std::chrono;
+
+      isStopped_ = false;
+      limits_ = limits;
+      startTime_ = steady_clock::now();
+      nodes_.store(0, std::memory_order_relaxed);
+      quiescenceNodes_ = 0;
+      previousPv_.clear();
+
+      // Killers belong to the plies of the last root. Keep the ordering learned by the last search, but let the new one outweigh it.
+      killers_ = {};
+      for (auto& fromTable : history_) {
+        for (auto& toTable : fromTable) {
+          for (int32_t& value : toTable) {
+            value /= 2;
+          }
+        }
+      }
+
+      Result result{};
+      const uint32_t maxDepth = std::clamp<uint32_t>(limits.depth, 1, kMaxPly - 1);
+      for (uint32_t iteration = 1; iteration <= maxDepth; ++iteration) {
+        // Odd helper threads run one ply ahead of the main thread, filling the table for its next iteration.
+        const uint32_t depth = std::min(iteration + threadId_ % 2, maxDepth);
+        rootDepth_ = depth;
+        BoardState& root = stack_[0].state;
+        root = state;
+        if (network_) {
+          nnue::refresh(*network_, root, accumulators_[0]);
+        }
+        Score score;
+        if (isMakeUnmake_) {
+          score = (root.getColor() == kWhite ? negamax<kWhite, true>(root, -kInfinity, kInfinity, depth, 0, true)
+                                             : negamax<kBlack, true>(root, -kInfinity, kInfinity, depth, 0, true));
+        } else {
+          score = (root.getColor() == kWhite ? negamax<kWhite, false>(root, -kInfinity, kInfinity, depth, 0, true)
+                                             : negamax<kBlack, false>(root, -kInfinity, kInfinity, depth, 0, true));
+        }
+
+        // A partial iteration is thrown away.
+        if (isStopped()) {
+          break;
+        }
+
+        previousPv_.assign(pv_[0].begin(), pv_[0].begin() + pvLength_[0]);
+        result.bestMove = (previousPv_.empty() ? kNullMove : previousPv_[0]);
+        result.score = score;
+        result.depth = depth;
+        result.pv = previousPv_;
+        result.nodes = getNodes();
+        result.quiescenceNodes = quiescenceNodes_;
+        result.time = duration_cast<milliseconds>(steady_clock::now() - startTime_);
+        result.nps = result.nodes * 1000 / std::max<uint64_t>(result.time.count(), 1);
+        if (onIteration) {
+          onIteration(result);
+        }
+
+        // No legal moves, or a forced mate that a deeper search can not improve on.
+        if (result.bestMove.isNull() || isStopping() ||
+            (isMateScore(score) && static_cast<uint32_t>(kMateScore - std::abs(score)) <= depth)) {
+          break;
+        }
+      }
+
+      result.nodes = getNodes();
+      result.quiescenceNodes = quiescenceNodes_;
+      return result;
+    }
+  };
+
+  // Lazy SMP. Every thread searches the same root with its own searcher, and they only share the transposition table.
+  // The main thread owns the limits and the reported result, the helpers run until it finishes.
+  class SmpSearcher {
+    TranspositionTable& tt_;
+    std::vector<std::unique_ptr<Searcher>> searchers_;
+    std::unique_ptr<ThreadPool> helperPool_;
+    const nnue::Network* network_;
+
+    uint64_t getNodes() const {
+      uint64_t nodes = 0;
+      for (const std::unique_ptr<Searcher>& searcher : searchers_) {
+        nodes += searcher->getNodes();
+      }
+      return nodes;
+    }
+
+  public:
+    explicit SmpSearcher(TranspositionTable& tt, uint32_t threadCount = 1) : tt_(tt), searchers_(), helperPool_(), network_(nullptr) {
+      setThreadCount(threadCount);
+    }
+
+    void setThreadCount(uint32_t threadCount) {
+      threadCount = std::max(threadCount, 1u);
+      searchers_.clear();
+      for (uint32_t i = 0; i < threadCount; ++i) {
+        searchers_.push_back(std::make_unique<Searcher>(tt_, i));
+        searchers_.back()->setNetwork(network_);
+      }
+      helperPool_ = (threadCount > 1 ? std::make_unique<ThreadPool>(threadCount - 1) : nullptr);
+    }
+
+    void setNetwork(const nnue::Network* network) {
+      network_ = network;
+      for (const std::unique_ptr<Searcher>& searcher : searchers_) {
+        searcher->setNetwork(network);
+      }
+    }
+
+    uint32_t getThreadCount() const {
+      return static_cast<uint32_t>(searchers_.size());
+    }
+
+    void stop() {
+      for (const std::unique_ptr<Searcher>& searcher : searchers_) {
+        searcher->stop();
+      }
+    }
+
+    void clearStop() {
+      for (const std::unique_ptr<Searcher>& searcher : searchers_) {
+        searcher->clearStop();
+      }
+    }
+
+    // The reported nodes and speed add up every thread.
+    Result search(const BoardState& state, const Limits& limits, const Searcher::IterationCallback& onIteration = nullptr) {
+      tt_.newSearch();
+
+      const Limits helperLimits{ .depth = limits.depth, .history = limits.history };
+      for (size_t i = 1; i < searchers_.size(); ++i) {
+        helperPool_->submit([this, i, &state, &helperLimits](size_t) { searchers_[i]->search(state, helperLimits); });
+      }
+
+      Result result = searchers_[0]->search(state, limits, [this, &onIteration](const Result& iteration) {
+        if (onIteration) {
+          Result total = iteration;
+          total.nodes = getNodes();
+          total.nps = total.nodes * 1000 / std::max<uint64_t>(total.time.count(), 1);
+          onIteration(total);
+        }
+      });
+
+      if (helperPool_) {
+        for (size_t i = 1; i < searchers_.size(); ++i) {
+          searchers_[i]->stop();
+        }
+        helperPool_->wait();
+        for (size_t i = 1; i < searchers_.size(); ++i) {
+          searchers_[i]->clearStop();
+        }
+      }
+
+      result.nodes = getNodes();
+      result.quiescenceNodes = 0;
+      for (const std::unique_ptr<Searcher>& searcher : searchers_) {
+        result.quiescenceNodes += searcher->getQuiescenceNodes();
+      }
+      result.nps = result.nodes * 1000 / std::max<uint64_t>(result.time.count(), 1);
+      return result;
+    }
+  };
+
+  inline Result search(const BoardState& state, const Limits& limits) {
+    TranspositionTable tt(kDefaultHashMegabytes);
+    auto searcher = std::make_unique<Searcher>(tt);  // Too large for the stack with its PV and accumulators.
+    return searcher->search(state, limits);
+  }
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////////
+//                 WORK STEALING THREAD POOL
+///////////////////////////////////////////////////////
+// Each worker owns a task deque. It pops from the back of its own deque, and steals
+// from the front of the others once it runs dry, so uneven subtrees balance themselves.
+class ThreadPool {
+public:
+  using Task = std::function<void(size_t workerId)>;
+
+private:
+  struct alignas(64) WorkQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<WorkQueue>> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<size_t> nextQueue_;
+
+  std::mutex mutex_;
+  std::condition_variable wakeCondition_;
+  std::condition_variable doneCondition_;
+  size_t queued_;   // Tasks sitting in the deques that no worker has reserved yet.
+  size_t pending_;  // Tasks submitted but not finished yet.
+  bool isStopping_;
+
+  bool tryPop(WorkQueue& queue, Task& task, bool isOwner) {
+    std::lock_guard lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      return false;
+    }
+    if (isOwner) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+    return true;
+  }
+
+  Task takeTask(size_t workerId) {
+    // The caller has reserved a task, so one of the deques is guaranteed to hold it.
+    Task task;
+    for (;;) {
+      if (tryPop(*queues_[workerId], task, true)) {
+        return task;
+      }
+      for (size_t i = 1; i < queues_.size(); ++i) {
+        if (tryPop(*queues_[(workerId + i) % queues_.size()], task, false)) {
+          return task;
+        }
+      }
+    }
+  }
+
+  void workerLoop(size_t workerId) {
+    for (;;) {
+      {
+        std::unique_lock lock(mutex_);
+        wakeCondition_.wait(lock, [this]() { return isStopping_ || queued_ > 0; });
+        if (queued_ == 0) {
+          return; // Stopping and drained.
+        }
+        --queued_;
+      }
+
+      takeTask(workerId)(workerId);
+
+      std::lock_guard lock(mutex_);
+      if (--pending_ == 0) {
+        doneCondition_.notify_all();
+      }
+    }
+  }
+
+public:
+  explicit ThreadPool(size_t threadCount)
+    : queues_(), workers_(), nextQueue_(0), mutex_(), wakeCondition_(), doneCondition_(), queued_(0), pending_(0), isStopping_(false) {
+    threadCount = (threadCount == 0 ? 1 : threadCount);
+    for (size_t i = 0; i < threadCount; ++i) {
+      queues_.push_back(std::make_unique<WorkQueue>());
+    }
+    for (size_t i = 0; i < threadCount; ++i) {
+      workers_.emplace_back([this, i]() { workerLoop(i); });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(mutex_);
+      isStopping_ = true;
+    }
+    wakeCondition_.notify_all();
+    for (std::thread& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  size_t size() const {
+    return workers_.size();
+  }
+
+  void submit(Task task) {
+    WorkQueue& queue = *queues_[nextQueue_.fetch_add(1, std::memory_order_relaxed) % queues_.size()];
+    {
+      std::lock_guard lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+    {
+      std::lock_guard lock(mutex_);
+      ++queued_;
+      ++pending_;
+    }
+    wakeCondition_.notify_one();
+  }
+
+  // Block until every submitted task has finished.
+  void wait() {
+    std::unique_lock lock(mutex_);
+    doneCondition_.wait(lock, [this]() { return pending_ == 0; });
+  }
+};
@@ -0,0 +1,187 @@
+#pragma once
+#include "move.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#ifdef _MSC_VER
+#include <xmmintrin.h>
+#endif
+
+///////////////////////////////////////////////////////
+//                 TRANSPOSITION TABLE
+///////////////////////////////////////////////////////
+namespace search {
+  enum Bound : uint8_t {
+    kNoBound,
+    kUpperBound,  // Failed low, the score is at most this.
+    kLowerBound,  // Failed high, the score is at least this.
+    kExactBound,
+  };
+
+  struct TTData {
+    PackedMove move;
+    int32_t score;
+    uint32_t depth;
+    Bound bound;
+  };
+
+  // A table shared by every search thread without locks. Each 16 byte entry stores key ^ data next to data,
+  // so an entry torn by a concurrent write fails validation instead of returning another position's data.
+  // Four entries make a 64 byte bucket, one cache line per probe.
+  class TranspositionTable {
+    // data layout: move 0-15, score 16-31, depth 32-39, bound 40-41, age 42-47.
+    struct Entry {
+      uint64_t check;
+      uint64_t data;
+    };
+
+    static constexpr size_t kBucketSize = 4;
+    struct alignas(64) Bucket {
+      std::array<Entry, kBucketSize> entries;
+    };
+    static_assert(sizeof(Bucket) == 64);
+
+    static constexpr uint32_t kAgeCycle = 64;
+
+    std::unique_ptr<Bucket[]> buckets_;
+    size_t mask_;
+    uint32_t age_;
+
+    static constexpr uint64_t packData(PackedMove move, int32_t score, uint32_t depth, Bound bound, uint32_t age) {
+      return static_cast<uint64_t>(move.getData()) |
+             static_cast<uint64_t>(static_cast<uint16_t>(score)) << 16 |
+             static_cast<uint64_t>(depth & 0xff) << 32 |
+             static_cast<uint64_t>(bound) << 40 |
+             static_cast<uint64_t>(age) << 42;
+    }
+
+    static constexpr uint32_t getDepth(uint64_t data) {
+      return (data >> 32) & 0xff;
+    }
+
+    static constexpr uint32_t getAge(uint64_t data) {
+      return (data >> 42) & (kAgeCycle - 1);
+    }
+
+    static uint64_t load(const uint64_t& value) {
+      return std::atomic_ref<uint64_t>(const_cast<uint64_t&>(value)).load(std::memory_order_relaxed);
+    }
+
+    static void store(uint64_t& value, uint64_t newValue) {
+      std::atomic_ref<uint64_t>(value).store(newValue, std::memory_order_relaxed);
+    }
+
+    Bucket& getBucket(uint64_t key) const {
+      return buckets_[key & mask_];
+    }
+
+  public:
+    explicit TranspositionTable(size_t megabytes, size_t threadCount = 1) : buckets_(), mask_(0), age_(0) {
+      resize(megabytes, threadCount);
+    }
+
+    TranspositionTable(const TranspositionTable&) = delete;
+    TranspositionTable& operator=(const TranspositionTable&) = delete;
+
+    // Round down to a power of two bucket count within the budget.
+    void resize(size_t megabytes, size_t threadCount = 1) {
+      const size_t bucketCount = std::bit_floor(std::max<size_t>(megabytes * 1024 * 1024 / sizeof(Bucket), 1));
+      if (bucketCount != mask_ + 1 || !buckets_) {
+        buckets_.reset();
+        buckets_ = std::make_unique_for_overwrite<Bucket[]>(bucketCount);
+        mask_ = bucketCount - 1;
+      }
+      clear(threadCount);
+    }
+
+    // Zero the table in parallel, each thread touching its own slice first also spreads the pages across the nodes.
+    void clear(size_t threadCount = 1) {
+      const size_t bucketCount = mask_ + 1;
+      threadCount = std::clamp<size_t>(threadCount, 1, bucketCount);
+      const size_t sliceSize = (bucketCount + threadCount - 1) / threadCount;
+
+      ThreadPool pool(threadCount);
+      for (size_t begin = 0; begin < bucketCount; begin += sliceSize) {
+        pool.submit([this, begin, end = std::min(begin + sliceSize, bucketCount)](size_t) {
+          std::memset(static_cast<void*>(&buckets_[begin]), 0, (end - begin) * sizeof(Bucket));
+        });
+      }
+      pool.wait();
+      age_ = 0;
+    }
+
+    // Entries from older searches become the first to be replaced.
+    void newSearch() {
+      age_ = (age_ + 1) % kAgeCycle;
+    }
+
+    // Called as soon as the child key is known, so the bucket is on its way while the child is set up.
+    void prefetch(uint64_t key) const {
+#ifdef _MSC_VER
+      _mm_prefetch(reinterpret_cast<const char*>(&getBucket(key)), _MM_HINT_T0);
+#else
+      __builtin_prefetch(&getBucket(key));
+#endif
+    }
+
+    bool probe(uint64_t key, TTData& result) const {
+      for (const Entry& entry : getBucket(key).entries) {
+        const uint64_t data = load(entry.data);
+        if ((load(entry.check) ^ data) == key && data) {
+          result.move = PackedMove::fromData(static_cast<uint16_t>(data));
+          result.score = static_cast<int16_t>(data >> 16);
+          result.depth = getDepth(data);
+          result.bound = static_cast<Bound>((data >> 40) & 0x3);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Overwrite the entry of the same position, otherwise the shallowest and oldest entry in the bucket.
+    void store(uint64_t key, PackedMove move, int32_t score, uint32_t depth, Bound bound) {
+      Bucket& bucket = getBucket(key);
+      Entry* victim = &bucket.entries[0];
+      int32_t victimWorth = INT32_MAX;
+      for (Entry& entry : bucket.entries) {
+        const uint64_t data = load(entry.data);
+        if ((load(entry.check) ^ data) == key) {
+          // Keep the old move if this search found none.
+          if (move.isNull()) {
+            move = PackedMove::fromData(static_cast<uint16_t>(data));
+          }
+          victim = &entry;
+          break;
+        }
+
+        const int32_t worth = static_cast<int32_t>(getDepth(data)) - 8 * static_cast<int32_t>((age_ - getAge(data)) % kAgeCycle);
+        if (worth < victimWorth) {
+          victimWorth = worth;
+          victim = &entry;
+        }
+      }
+
+      const uint64_t data = packData(move, score, depth, bound, age_);
+      store(victim->check, key ^ data);
+      store(victim->data, data);
+    }
+
+    // Permille of the sampled entries written by the current search, the UCI hashfull.
+    uint32_t getHashFull() const {
+      const size_t sampleSize = std::min<size_t>(1000 / kBucketSize, mask_ + 1);
+      uint32_t used = 0;
+      for (size_t i = 0; i < sampleSize; ++i) {
+        for (const Entry& entry : buckets_[i].entries) {
+          const uint64_t data = load(entry.data);
+          used += (data && getAge(data) == age_);
+        }
+      }
+      return static_cast<uint32_t>(used * 1000 / (sampleSize * kBucketSize));
+    }
+  };
+}
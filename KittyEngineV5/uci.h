@@ -0,0 +1,313 @@
+#pragma once
+#include "board.h"
+#include "move_list.h"
+#include "nnue.h"
+#include "perft_driver.h"
+#include "polyglot.h"
+#include "search.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////////
+//                 UCI
+///////////////////////////////////////////////////////
+namespace uci {
+  inline constexpr const char* kStartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+  inline std::string scoreToString(search::Score score) {
+    if (search::isMateScore(score)) {
+      // Plies to mate, rounded up to moves, negative when getting mated.
+      const int32_t moves = (search::kMateScore - std::abs(score) + 1) / 2;
+      return std::format("mate {}", score > 0 ? moves : -moves);
+    }
+    return std::format("cp {}", score);
+  }
+
+  // Reads commands on the calling thread, and runs go on a worker thread so stop and isready answer at once.
+  class Engine {
+    static constexpr std::chrono::milliseconds kMoveOverhead{ 30 };
+
+    std::ostream& out_;
+    std::mutex outMutex_;
+    BoardState state_;
+    std::vector<uint64_t> history_;  // Keys of the positions before state_ since the last irreversible move.
+    size_t hashMegabytes_;
+    uint32_t threadCount_;
+    search::TranspositionTable tt_;
+    search::SmpSearcher searcher_;
+    std::unique_ptr<nnue::Network> network_;
+    std::unique_ptr<polyglot::Book> book_;
+    std::mt19937_64 bookRng_;
+    std::unique_ptr<perft::HashTable> perftHashTable_;  // Allocated by the first go perft, then kept for the later ones.
+    std::atomic<bool> isPerftStopped_;
+
+    // An infinite search holds its bestmove until stop, even after it finished early on a mate or no legal moves.
+    std::mutex stopMutex_;
+    std::condition_variable stopCondition_;
+    bool isStopRequested_;
+    std::thread worker_;
+
+    void write(const std::string& line) {
+      std::lock_guard lock(outMutex_);
+      out_ << line << std::endl;
+    }
+
+    void onPosition(std::istringstream& ss) {
+      std::string token;
+      ss >> token;
+      if (token == "startpos") {
+        state_ = BoardState::fromFEN(kStartFEN);
+        ss >> token;
+      } else if (token == "fen") {
+        // An invalid fen keeps the previous position along with its history.
+        std::string fen;
+        while (ss >> token && token != "moves") {
+          fen += token + ' ';
+        }
+        BoardState state;
+        if (const FenError error = BoardState::parseFEN(fen, state); error != kFenOk) {
+          write(std::format("info string invalid fen {}, error {}", fen, static_cast<uint32_t>(error)));
+          return;
+        }
+        state_ = state;
+      } else {
+        return;
+      }
+      history_.clear();
+
+      // parseMove only reads the shape of the string, isLegal checks it against the position without generating moves.
+      if (token == "moves") {
+        while (ss >> token) {
+          const PackedMove move = state_.parseMove(token);
+          if (move.isNull() || !state_.isLegal(move)) {
+            write(std::format("info string invalid move {}", token));
+            break;
+          }
+          history_.push_back(state_.key_);
+          state_.makeMove(move);
+          if (state_.halfmove_ == 0) {
+            history_.clear();
+          }
+        }
+      }
+    }
+
+    void onSetOption(std::istringstream& ss) {
+      // setoption name <id> value <x>
+      std::string token, name, value;
+      ss >> token >> name >> token >> value;
+      if (name == "Hash") {
+        hashMegabytes_ = std::clamp<size_t>(std::strtoull(value.c_str(), nullptr, 10), 1, 1 << 16);
+        tt_.resize(hashMegabytes_, threadCount_);
+      } else if (name == "EvalFile") {
+        // The path runs to the end of the line and may contain spaces. An empty path goes back to the piece square tables.
+        std::string rest;
+        std::getline(ss, rest);
+        const std::string path = (value == "<empty>" ? "" : value + rest);
+        std::unique_ptr<nnue::Network> network = (path.empty() ? nullptr : nnue::Network::load(path));
+        if (!path.empty() && !network) {
+          write(std::format("info string can not load network {}", path));
+          return;
+        }
+        searcher_.setNetwork(network.get());
+        network_ = std::move(network);
+      } else if (name == "BookFile") {
+        // Same as EvalFile, an empty path turns the book off.
+        std::string rest;
+        std::getline(ss, rest);
+        const std::string path = (value == "<empty>" ? "" : value + rest);
+        book_ = (path.empty() ? nullptr : polyglot::Book::open(path));
+        if (!path.empty() && !book_) {
+          write(std::format("info string can not open book {}", path));
+        }
+      } else if (name == "Threads") {
+        threadCount_ = std::clamp<uint32_t>(std::strtoul(value.c_str(), nullptr, 10), 1, 1024);
+        searcher_.setThreadCount(threadCount_);
+      } else {
+        write(std::format("info string unknown option {}", name));
+      }
+    }
+
+    // Print the node count under each root move, then the total. A stopped perft prints the moves it finished.
+    void runPerft(const BoardState& state, uint32_t depth) {
+      constexpr perft::Config config{ true, true, false, true };
+      if (!perftHashTable_) {
+        perftHashTable_ = std::make_unique<perft::HashTable>(perft::kDefaultHashMegabytes);
+      }
+      uint64_t total = 0;
+      for (PackedMove move : MoveList::fromState(state)) {
+        BoardState child = state;
+        child.makeMove(move);
+        const uint64_t nodes = (depth <= 1 ? 1 : perft::runPerft<config, false>(child, depth - 1, threadCount_, perftHashTable_.get(), &isPerftStopped_).nodes);
+        if (isPerftStopped_.load(std::memory_order_relaxed)) {
+          break;
+        }
+        write(std::format("{}: {}", moveToString(move), nodes));
+        total += nodes;
+      }
+      write(std::format("\nNodes searched: {}", total));
+    }
+
+    void onGo(std::istringstream& ss) {
+      search::Limits limits{ .history = history_ };
+      std::chrono::milliseconds time{ 0 }, increment{ 0 };
+      uint32_t movesToGo = 0;
+      const std::string timeToken = (state_.getColor() == kWhite ? "wtime" : "btime");
+      const std::string incrementToken = (state_.getColor() == kWhite ? "winc" : "binc");
+
+      bool isInfinite = false;
+      std::string token;
+      while (ss >> token) {
+        uint64_t value = 0;
+        if (token == "perft") {
+          ss >> value;
+          worker_ = std::thread([this, state = state_, depth = static_cast<uint32_t>(value)]() { runPerft(state, depth); });
+          return;
+        } else if (token == "infinite") {
+          isInfinite = true;
+          continue;
+        }
+        ss >> value;
+        if (token == "depth") {
+          limits.depth = static_cast<uint32_t>(value);
+        } else if (token == "nodes") {
+          limits.nodes = value;
+        } else if (token == "movetime") {
+          limits.moveTime = std::chrono::milliseconds(value);
+        } else if (token == timeToken) {
+          time = std::chrono::milliseconds(value);
+        } else if (token == incrementToken) {
+          increment = std::chrono::milliseconds(value);
+        } else if (token == "movestogo") {
+          movesToGo = static_cast<uint32_t>(value);
+        }
+      }
+
+      // A book move answers at once, except for an infinite search, which must wait for stop.
+      if (book_ && !isInfinite) {
+        if (const PackedMove move = book_->probe(state_, bookRng_()); !move.isNull()) {
+          write(std::format("bestmove {}", moveToString(move)));
+          return;
+        }
+      }
+
+      // Spend an even share of the clock plus most of the increment, always keeping a safety margin.
+      if (time.count() && !limits.moveTime.count()) {
+        const std::chrono::milliseconds budget = time / (movesToGo ? movesToGo : 30) + increment * 3 / 4;
+        limits.moveTime = std::max(std::min(budget, time - kMoveOverhead), std::chrono::milliseconds(1));
+      }
+
+      worker_ = std::thread([this, state = state_, limits, isInfinite]() {
+        const search::Result result = searcher_.search(state, limits, [this](const search::Result& iteration) {
+          std::string pv;
+          for (PackedMove move : iteration.pv) {
+            pv += ' ' + moveToString(move);
+          }
+          write(std::format("info depth {} score {} nodes {} nps {} time {} hashfull {} pv{}",
+                            iteration.depth, scoreToString(iteration.score), iteration.nodes, iteration.nps,
+                            iteration.time.count(), tt_.getHashFull(), pv));
+        });
+        if (isInfinite) {
+          std::unique_lock lock(stopMutex_);
+          stopCondition_.wait(lock, [this]() { return isStopRequested_; });
+        }
+        write(std::format("bestmove {}", result.bestMove.isNull() ? "0000" : moveToString(result.bestMove)));
+      });
+    }
+
+  public:
+    explicit Engine(std::ostream& out)
+      : out_(out), outMutex_(), state_(BoardState::fromFEN(kStartFEN)), history_(), hashMegabytes_(search::kDefaultHashMegabytes), threadCount_(1),
+        tt_(hashMegabytes_), searcher_(tt_), network_(), book_(),
+        bookRng_(std::random_device{}()), perftHashTable_(), isPerftStopped_(false),
+        stopMutex_(), stopCondition_(), isStopRequested_(false), worker_() {}
+
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    ~Engine() {
+      stop();
+    }
+
+    // Stop the running search or perft, the search still prints its bestmove.
+    void stop() {
+      if (worker_.joinable()) {
+        {
+          std::lock_guard lock(stopMutex_);
+          isStopRequested_ = true;
+        }
+        stopCondition_.notify_one();
+        searcher_.stop();
+        isPerftStopped_.store(true, std::memory_order_relaxed);
+        worker_.join();
+        searcher_.clearStop();
+        isPerftStopped_.store(false, std::memory_order_relaxed);
+        isStopRequested_ = false;
+      }
+    }
+
+    // Wait for a search with a limit or a perft to finish. An infinite search only ends on stop.
+    void wait() {
+      if (worker_.joinable()) {
+        worker_.join();
+      }
+    }
+
+    // Return false once the GUI asks to quit.
+    bool execute(const std::string& line) {
+      std::istringstream ss(line);
+      std::string command;
+      ss >> command;
+
+      if (command == "uci") {
+        write("id name KittyEngineV5\nid author evanhyd");
+        write(std::format("option name Hash type spin default {} min 1 max 65536", search::kDefaultHashMegabytes));
+        write("option name Threads type spin default 1 min 1 max 1024");
+        write("option name EvalFile type string default <empty>");
+        write("option name BookFile type string default <empty>");
+        write("uciok");
+      } else if (command == "isready") {
+        write("readyok");
+      } else if (command == "ucinewgame") {
+        stop();
+        tt_.clear(threadCount_);
+      } else if (command == "position") {
+        stop();
+        onPosition(ss);
+      } else if (command == "go") {
+        stop();
+        onGo(ss);
+      } else if (command == "stop") {
+        stop();
+      } else if (command == "setoption") {
+        stop();
+        onSetOption(ss);
+      } else if (command == "d") {
+        std::ostringstream board;
+        board << state_;
+        write(board.str());
+      } else if (command == "quit") {
+        stop();
+        return false;
+      }
+      return true;
+    }
+
+    void loop(std::istream& in) {
+      for (std::string line; std::getline(in, line) && execute(line);) {
+      }
+    }
+  };
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "bitboard.h"
+
+///////////////////////////////////////////////////////
+//                 ZOBRIST HASHING
+///////////////////////////////////////////////////////
+namespace internal {
+  // SplitMix64, fixed seed so the keys are identical across builds and runs.
+  inline constexpr uint64_t splitMix64(uint64_t& seed) {
+    uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  struct ZobristKeyTable {
+    std::array<std::array<std::array<uint64_t, kSquareSize>, kPieceSize>, kColorSize> pieces;
+    std::array<uint64_t, kSquareSize> castle;    // Indexed by the castle permission squares.
+    std::array<uint64_t, kSideSize> enpassant;   // Indexed by the enpassant file.
+    uint64_t side;                               // Black to move.
+  };
+
+  inline constexpr auto kZobristKeyTable = []() {
+    uint64_t seed = 0x4b697474794b6579ull;
+    ZobristKeyTable table{};
+    for (Color color : {kWhite, kBlack}) {
+      for (Piece piece = kPawn; piece < kNoPiece; ++piece) {
+        for (Square i = 0; i < kSquareSize; ++i) {
+          table.pieces[color][piece][i] = splitMix64(seed);
+        }
+      }
+    }
+    for (Square i = 0; i < kSquareSize; ++i) {
+      table.castle[i] = splitMix64(seed);
+    }
+    for (Square i = 0; i < kSideSize; ++i) {
+      table.enpassant[i] = splitMix64(seed);
+    }
+    table.side = splitMix64(seed);
+    return table;
+  }();
+}
+
+[[nodiscard]] inline constexpr uint64_t getPieceKey(Color color, Piece piece, Square square) {
+  return internal::kZobristKeyTable.pieces[color][piece][square];
+}
+
+// Castle permission is stored as a bitboard of the king and rook home squares, hash each square.
+[[nodiscard]] inline constexpr uint64_t getCastleKey(Bitboard permission) {
+  uint64_t key = 0;
+  for (; permission; permission = popPiece(permission)) {
+    key ^= internal::kZobristKeyTable.castle[peekPiece(permission)];
+  }
+  return key;
+}
+
+[[nodiscard]] inline constexpr uint64_t getEnpassantKey(Square square) {
+  return (square == NO_SQUARE ? 0 : internal::kZobristKeyTable.enpassant[getSquareFile(square)]);
+}
+
+[[nodiscard]] inline constexpr uint64_t getSideKey() {
+  return internal::kZobristKeyTable.side;
+}